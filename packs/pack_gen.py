@@ -2,7 +2,19 @@ import os
 import glob
 import struct
 
-FORMAT_VERSION = 0
+FORMAT_VERSION = 1
+# Version 1 entries start at a multiple of this, so they are page aligned when the pack is memory mapped.
+ALIGNMENT = 4096
+COMPRESSION_NONE = 0
+COMPRESSION_LZ4 = 1
+# These are already compressed, compressing them again only costs load time.
+NO_COMPRESSION_EXTENSIONS = ['.png', '.jpg', '.jpeg', '.ogg', '.wav', '.ttf', '.zip']
+
+try:
+	import lz4.block
+except ImportError:
+	lz4 = None
+	print 'lz4 module not found, writing uncompressed pack'
 
 def convertObj(filename):
 	f = open(filename, 'r')
@@ -55,6 +67,12 @@ def buildPack(name):
 				f.close()
 			files[filename] = data
 	os.chdir('..')
+	if FORMAT_VERSION == 0:
+		writePackV0(name, files)
+	else:
+		writePackV1(name, files)
+
+def writePackV0(name, files):
 	f = open(name + '.pack', 'wb')
 	flog = open(name + '.packlist', 'wb')
 	f.write(struct.pack('>i', FORMAT_VERSION))
@@ -74,6 +92,55 @@ def buildPack(name):
 	f.close()
 	flog.close()
 
+def hashName(filename):
+	# FNV-1a, the same hash is used by PackResourceProvider.
+	h = 2166136261
+	for c in bytearray(filename):
+		h ^= c
+		h = (h * 16777619) & 0xFFFFFFFF
+	return h
+
+def align(offset):
+	return (offset + ALIGNMENT - 1) // ALIGNMENT * ALIGNMENT
+
+def writePackV1(name, files):
+	entries = []
+	for filename, data in files.items():
+		compression = COMPRESSION_NONE
+		stored = data
+		if lz4 is not None and os.path.splitext(filename)[1].lower() not in NO_COMPRESSION_EXTENSIONS:
+			compressed = lz4.block.compress(data, store_size=False)
+			# Only worth it if it saves at least one page.
+			if len(compressed) + ALIGNMENT <= len(data):
+				compression = COMPRESSION_LZ4
+				stored = compressed
+		entries.append((hashName(filename), filename, compression, stored, len(data)))
+	entries.sort()
+
+	string_table = ''
+	name_offsets = []
+	string_table_offset = 12 + 40 * len(entries)
+	for entry in entries:
+		name_offsets.append(string_table_offset + len(string_table))
+		string_table += entry[1]
+
+	f = open(name + '.pack', 'wb')
+	flog = open(name + '.packlist', 'wb')
+	f.write(struct.pack('>iiI', FORMAT_VERSION, len(entries), len(string_table)))
+	offset = align(string_table_offset + len(string_table))
+	for entry, name_offset in zip(entries, name_offsets):
+		hash, filename, compression, stored, size = entry
+		f.write(struct.pack('>IIIIQQQ', hash, name_offset, len(filename), compression, offset, len(stored), size))
+		flog.write(filename + '\n')
+		print offset, filename, len(stored), size
+		offset = align(offset + len(stored))
+	f.write(string_table)
+	for entry in entries:
+		f.write('\0' * (align(f.tell()) - f.tell()))
+		f.write(entry[3])
+	f.close()
+	flog.close()
+
 def main():
 	for dir in os.listdir("."):
 		if os.path.isdir(dir):
@@ -5,12 +5,15 @@
 // Program inputs
 uniform mat4 projection;
 uniform mat4 view;
+uniform float time;
 
 // Per-vertex inputs
-attribute vec3 center;
+attribute vec3 start_center;
+attribute vec3 end_center;
 attribute vec2 texcoords;
-attribute vec3 color;
-attribute float size;
+attribute vec3 start_color;
+attribute vec3 end_color;
+attribute vec4 params; // start size, end size, spawn time, life time
 
 // Per-vertex outputs
 varying vec3 fragcolor;
@@ -18,13 +21,19 @@ varying vec2 fragtexcoords;
 
 void main()
 {
-    vec4 viewspace_center = view * vec4(center, 1.0);
+    float age = time - params.z;
+    float t = clamp(age / max(params.w, 0.0001), 0., 1.);
+    float f = t * (2. - t); // Quadratic ease out.
+    // Expired particles collapse into a point, which is not drawn.
+    float size = mix(params.x, params.y, f) * step(age, params.w);
+
+    vec4 viewspace_center = view * vec4(mix(start_center, end_center, f), 1.0);
     vec4 viewspace_halfextents = vec4(texcoords.x - .5, texcoords.y - .5, 0., 0.) * size;
 
     // Outputs to fragment shader
     gl_Position = projection * (viewspace_center + viewspace_halfextents);
     fragtexcoords = texcoords;
-    fragcolor = color;
+    fragcolor = mix(start_color, end_color, f);
 }
 
 [fragment]
@@ -24,3 +24,4 @@ require("api/entity/beameffect.lua")
 
 require("api/gm.lua")
 require("api/callsign.lua")
+require("api/baseEnvironment.lua")
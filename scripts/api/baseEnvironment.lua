@@ -0,0 +1,70 @@
+-- The base environment is only loaded for the first scenario. After model_data.lua, factionInfo.lua, shipTemplates.lua
+-- and science_db.lua ran, the data they created is copied, and following scenario starts restore this copy instead of
+-- running those scripts again. This also undoes changes the previous scenario made to the templates.
+-- The faction and science database entities are recreated by the game, which registers the factions with __registerFactionInfo.
+local snapshot = nil
+
+local function deepCopy(value, copies)
+    if type(value) ~= "table" then
+        return value
+    end
+    if copies[value] ~= nil then
+        return copies[value]
+    end
+    local result = {}
+    copies[value] = result
+    for k, v in pairs(value) do
+        result[deepCopy(k, copies)] = deepCopy(v, copies)
+    end
+    return setmetatable(result, getmetatable(value))
+end
+
+local function copyState(state)
+    local copies = {}
+    return {
+        model_data = deepCopy(state.model_data, copies),
+        ship_templates = deepCopy(state.ship_templates, copies),
+        player_ship_templates = deepCopy(state.player_ship_templates, copies),
+        allow_new_player_ships = state.allow_new_player_ships,
+        random_callsign_index = state.random_callsign_index,
+        random_callsign_prefix_length = state.random_callsign_prefix_length,
+        random_callsign_prefix_pool = deepCopy(state.random_callsign_prefix_pool, copies),
+        default_station_faction = state.default_station_faction,
+        default_cpu_ship_faction = state.default_cpu_ship_faction,
+        default_player_ship_faction = state.default_player_ship_faction,
+    }
+end
+
+function __snapshotBaseEnvironment()
+    snapshot = copyState{
+        model_data = __model_data,
+        ship_templates = __ship_templates,
+        player_ship_templates = __player_ship_templates,
+        allow_new_player_ships = __allow_new_player_ships,
+        random_callsign_index = __random_callsign_index,
+        random_callsign_prefix_length = __random_callsign_prefix_length,
+        random_callsign_prefix_pool = __random_callsign_prefix_pool,
+        default_station_faction = __default_station_faction,
+        default_cpu_ship_faction = __default_cpu_ship_faction,
+        default_player_ship_faction = __default_player_ship_faction,
+    }
+end
+
+function __restoreBaseEnvironment()
+    local state = copyState(snapshot)
+    __model_data = state.model_data
+    __ship_templates = state.ship_templates
+    __player_ship_templates = state.player_ship_templates
+    __allow_new_player_ships = state.allow_new_player_ships
+    __random_callsign_index = state.random_callsign_index
+    __random_callsign_prefix_length = state.random_callsign_prefix_length
+    __random_callsign_prefix_pool = state.random_callsign_prefix_pool
+    __default_station_faction = state.default_station_faction
+    __default_cpu_ship_faction = state.default_cpu_ship_faction
+    __default_player_ship_faction = state.default_player_ship_faction
+    __faction_info = {}
+end
+
+function __registerFactionInfo(faction)
+    __faction_info[faction.components.faction_info.name] = faction
+end
@@ -31,11 +31,7 @@ local Entity = getLuaEntityFunctionTable()
 --- Defaults to a ModelData whose name starts with "artifact" and ends with a random number between 1 and 8.
 --- Example: artifact:setModel("artifact6")
 function Entity:setModel(model_name)
-    for k, v in pairs(__model_data[model_name]) do
-        if string.sub(1, 2) ~= "__" then
-            self.components[k] = table.deepcopy(v)
-        end
-    end
+    __applyModelData(self, model_name)
     return self
 end
 --- Immediately destroys this artifact with a visual explosion.
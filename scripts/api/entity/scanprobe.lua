@@ -26,11 +26,7 @@ function ScanProbe()
     local idx = irandom(1, 3)
     if idx == 2 then model = "SensorBuoyMKII" end
     if idx == 3 then model = "SensorBuoyMKIII" end
-    for k, v in pairs(__model_data[model]) do
-        if string.sub(1, 2) ~= "__" then
-            e.components[k] = table.deepcopy(v)
-        end
-    end
+    __applyModelData(e, model)
     e.components.physics.type = "sensor"
     return e
 end
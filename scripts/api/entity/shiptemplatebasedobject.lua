@@ -32,42 +32,51 @@ function Entity:setTemplate(template_name)
         if comp.shields then comp.shields.active = false end
     end
 
-    if comp.reactor then
+    -- Every component lookup goes trough the entity, so look up the components that are changed below only once.
+    local reactor = comp.reactor
+    local beam_weapons = comp.beam_weapons
+    local missile_tubes = comp.missile_tubes
+    local maneuvering_thrusters = comp.maneuvering_thrusters
+    local impulse_engine = comp.impulse_engine
+    local warp_drive = comp.warp_drive
+    local jump_drive = comp.jump_drive
+    local shields = comp.shields
+    local internal_rooms = comp.internal_rooms
+    if reactor then
         local reactor_power_factor = 0
-        if comp.beam_weapons then comp.beam_weapons.power_factor = 3.0; reactor_power_factor = reactor_power_factor - 3.0 end
-        if comp.missile_tubes then comp.missile_tubes.power_factor = 1.0; reactor_power_factor = reactor_power_factor - 1.0 end
-        if comp.maneuvering_thrusters then comp.maneuvering_thrusters.power_factor = 2.0; reactor_power_factor = reactor_power_factor - 2.0 end
-        if comp.impulse_engine then comp.impulse_engine.power_factor = 4.0; reactor_power_factor = reactor_power_factor - 4.0 end
-        if comp.warp_drive then comp.warp_drive.power_factor = 5.0; reactor_power_factor = reactor_power_factor - 5.0 end
-        if comp.jump_drive then comp.jump_drive.power_factor = 5.0; reactor_power_factor = reactor_power_factor - 5.0 end
-        if comp.shields then
-            comp.shields.front_power_factor = 5.0; reactor_power_factor = reactor_power_factor - 5.0
-            comp.shields.rear_power_factor = 5.0; reactor_power_factor = reactor_power_factor - 5.0
+        if beam_weapons then beam_weapons.power_factor = 3.0; reactor_power_factor = reactor_power_factor - 3.0 end
+        if missile_tubes then missile_tubes.power_factor = 1.0; reactor_power_factor = reactor_power_factor - 1.0 end
+        if maneuvering_thrusters then maneuvering_thrusters.power_factor = 2.0; reactor_power_factor = reactor_power_factor - 2.0 end
+        if impulse_engine then impulse_engine.power_factor = 4.0; reactor_power_factor = reactor_power_factor - 4.0 end
+        if warp_drive then warp_drive.power_factor = 5.0; reactor_power_factor = reactor_power_factor - 5.0 end
+        if jump_drive then jump_drive.power_factor = 5.0; reactor_power_factor = reactor_power_factor - 5.0 end
+        if shields then
+            shields.front_power_factor = 5.0; reactor_power_factor = reactor_power_factor - 5.0
+            shields.rear_power_factor = 5.0; reactor_power_factor = reactor_power_factor - 5.0
         end
-        comp.reactor.power_factor = reactor_power_factor
+        reactor.power_factor = reactor_power_factor
     end
-    if comp.internal_rooms and template.__repair_crew_count and template.__repair_crew_count > 0 then
+    if internal_rooms and template.__repair_crew_count and template.__repair_crew_count > 0 then
         for n=1,template.__repair_crew_count do
             local crew = createEntity()
-            crew.components.internal_crew = {ship=self}
-            crew.components.internal_repair_crew = {}
+            crew.components = {internal_crew = {ship=self}, internal_repair_crew = {}}
         end
     end
-    if comp.shields and template.__type ~= "station" then
-        comp.shields.frequency = irandom(0, 20)
+    if shields and template.__type ~= "station" then
+        shields.frequency = irandom(0, 20)
     end
-    if comp.internal_rooms == nil then -- No internal rooms, so auto-repair
-        if comp.beam_weapons then comp.beam_weapons.auto_repair_per_second = 0.005; end
-        if comp.missile_tubes then comp.missile_tubes.auto_repair_per_second = 0.005 end
-        if comp.maneuvering_thrusters then comp.maneuvering_thrusters.auto_repair_per_second = 0.005 end
-        if comp.impulse_engine then comp.impulse_engine.auto_repair_per_second = 0.005 end
-        if comp.warp_drive then comp.warp_drive.auto_repair_per_second = 0.005 end
-        if comp.jump_drive then comp.jump_drive.auto_repair_per_second = 0.005 end
-        if comp.shields then
-            comp.shields.front_auto_repair_per_second = 0.005
-            comp.shields.rear_auto_repair_per_second = 0.005
+    if internal_rooms == nil then -- No internal rooms, so auto-repair
+        if beam_weapons then beam_weapons.auto_repair_per_second = 0.005; end
+        if missile_tubes then missile_tubes.auto_repair_per_second = 0.005 end
+        if maneuvering_thrusters then maneuvering_thrusters.auto_repair_per_second = 0.005 end
+        if impulse_engine then impulse_engine.auto_repair_per_second = 0.005 end
+        if warp_drive then warp_drive.auto_repair_per_second = 0.005 end
+        if jump_drive then jump_drive.auto_repair_per_second = 0.005 end
+        if shields then
+            shields.front_auto_repair_per_second = 0.005
+            shields.rear_auto_repair_per_second = 0.005
         end
-        if comp.reactor then comp.reactor.auto_repair_per_second = 0.005 end
+        if reactor then reactor.auto_repair_per_second = 0.005 end
     end
     return self
 end
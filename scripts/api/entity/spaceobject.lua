@@ -5,13 +5,15 @@ local Entity = getLuaEntityFunctionTable()
 --- Sets this SpaceObject's position on the map, in meters from the origin.
 --- Example: obj:setPosition(x,y)
 function Entity:setPosition(x, y)
-    if self.components.transform then self.components.transform.position = {x, y} end
+    local transform = self.components.transform
+    if transform then transform.position = {x, y} end
     return self
 end
 --- Returns this object's position on the map.
 --- Example: x,y = obj:getPosition()
 function Entity:getPosition()
-    if self.components.transform then return table.unpack(self.components.transform.position) end
+    local transform = self.components.transform
+    if transform then return table.unpack(transform.position) end
 end
 --- Sets this SpaceObject's absolute rotation, in degrees.
 --- Unlike SpaceObject:setHeading(), a value of 0 points to the right of the map ("east").
@@ -19,13 +21,15 @@ end
 --- SpaceObject:setHeading() and SpaceObject:setRotation() do not change the helm's target heading on PlayerSpaceships. To do that, use PlayerSpaceship:commandTargetRotation().
 --- Example: obj:setRotation(270)
 function Entity:setRotation(rotation)
-    if self.components.transform then self.components.transform.rotation = rotation end
+    local transform = self.components.transform
+    if transform then transform.rotation = rotation end
     return self
 end
 --- Returns this SpaceObject's absolute rotation, in degrees.
 --- Example: local rotation = obj:getRotation()
 function Entity:getRotation()
-    if self.components.transform then return self.components.transform.rotation end
+    local transform = self.components.transform
+    if transform then return transform.rotation end
 end
 --- Sets this SpaceObject's heading, in degrees ranging from 0 to 360.
 --- Unlike SpaceObject:setRotation(), a value of 0 points to the top of the map ("north").
@@ -33,14 +37,16 @@ end
 --- SpaceObject:setHeading() and SpaceObject:setRotation() do not change the helm's target heading on PlayerSpaceships. To do that, use PlayerSpaceship:commandTargetRotation().
 --- Example: obj:setHeading(0)
 function Entity:setHeading(heading)
-    if self.components.transform then self.components.transform.rotation = heading + 270 end
+    local transform = self.components.transform
+    if transform then transform.rotation = heading + 270 end
     return self
 end
 --- Returns this SpaceObject's heading, in degrees ranging from 0 to 360.
 --- Example: heading = obj:getHeading(0)
 function Entity:getHeading()
-    if self.components.transform then
-        local heading = self.components.transform.rotation - 270
+    local transform = self.components.transform
+    if transform then
+        local heading = transform.rotation - 270
         while heading < 0 do heading = heading + 360 end
         while heading > 360 do heading = heading - 360 end
         return heading
@@ -51,12 +57,14 @@ end
 --- The values are relative x/y coordinates from the SpaceObject's current position (a 2D velocity vector).
 --- Example: vx,vy = obj:getVelocity()
 function Entity:getVelocity()
-    if self.components.physics then return table.unpack(self.components.physics.velocity) end
+    local physics = self.components.physics
+    if physics then return table.unpack(physics.velocity) end
 end
 --- Returns this SpaceObject's rotational velocity within 2D space, in degrees per second.
 --- Example: obj:getAngularVelocity()
 function Entity:getAngularVelocity()
-    if self.components.physics then return self.components.physics.angular_velocity end
+    local physics = self.components.physics
+    if physics then return physics.angular_velocity end
 end
 --- Sets the faction to which this SpaceObject belongs, by faction name.
 --- Factions are defined by the FactionInfo class, and default factions are defined in scripts/factionInfo.lua.
@@ -8,11 +8,7 @@
 function SupplyDrop()
     local e = createEntity()
     e.components.transform = {}
-    for k, v in pairs(__model_data["ammo_box"]) do
-        if string.sub(1, 2) ~= "__" then
-            e.components[k] = table.deepcopy(v)
-        end
-    end
+    __applyModelData(e, "ammo_box")
     e.components = {
         physics={type="Sensor"},
         radar_trace={
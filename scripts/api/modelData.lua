@@ -17,6 +17,17 @@ __model_data = {}
 --- For complete examples, see scripts/model_data.lua.
 ModelData = createClass()
 
+-- Adds the components of a ModelData to an entity. Entries starting with __ are not components.
+-- Assigning a table to a component copies the values into the component, so the ModelData tables can be assigned as they are.
+function __applyModelData(entity, model_data_name)
+    local components = entity.components
+    for key, value in next, __model_data[model_data_name], nil do
+        if string.sub(key, 1, 2) ~= "__" then
+            components[key] = value
+        end
+    end
+end
+
 --- Sets this ModelData's name.
 --- Use this name when referencing a ModelData from other objects.
 --- Example: model:setName("space_station_1")
@@ -79,20 +79,16 @@ void ShipAI::run(float delta)
     if (warp)
         warp->request = 0;
 
-    // Update ranges before calculating
-    if (auto lrr = owner.getComponent<LongRangeRadar>()) {
-        long_range = lrr->long_range;
-        relay_range = long_range * 2.0f;
-        short_range = lrr->short_range;
-    }
+    updateRanges();
 
-    updateWeaponState(delta);
-    if (update_target_delay > 0.0f)
+    if (missile_fire_delay > 0.0f)
+        missile_fire_delay -= delta;
+
+    weapon_state_delta += delta;
+    if (allow_expensive_update)
     {
-        update_target_delay -= delta;
-    }else{
-        update_target_delay = random(0.25, 0.5);
-        updateTarget();
+        updateWeaponState(weapon_state_delta);
+        weapon_state_delta = 0.0f;
     }
 
     //If we have a target and weapons, engage the target.
@@ -104,6 +100,15 @@ void ShipAI::run(float delta)
     }
 }
 
+void ShipAI::updateRanges()
+{
+    if (auto lrr = owner.getComponent<LongRangeRadar>()) {
+        long_range = lrr->long_range;
+        relay_range = long_range * 2.0f;
+        short_range = lrr->short_range;
+    }
+}
+
 static int getDirectionIndex(float direction, float arc)
 {
     if (fabs(angleDifference(direction, 0.0f)) < arc / 2.0f)
@@ -119,9 +124,6 @@ static int getDirectionIndex(float direction, float arc)
 
 void ShipAI::updateWeaponState(float delta)
 {
-    if (missile_fire_delay > 0.0f)
-        missile_fire_delay -= delta;
-
     //Update the weapon state, figure out which direction is our main attack vector. If we have missile and/or beam weapons, and what we should preferer.
     has_missiles = false;
     has_beams = false;
@@ -246,69 +248,101 @@ void ShipAI::updateWeaponState(float delta)
     }
 }
 
-void ShipAI::updateTarget()
+bool ShipAI::prepareTargetDecision(float delta)
 {
-    sp::ecs::Entity target = owner.hasComponent<Target>() ? owner.getComponent<Target>()->entity : sp::ecs::Entity{};
-    sp::ecs::Entity new_target;
-    auto ot = owner.getComponent<sp::Transform>();
-    if (!ot) return;
-    auto position = ot->getPosition();
+    target_decision.pending = false;
+    if (update_target_delay > 0.0f)
+    {
+        update_target_delay -= delta;
+        return false;
+    }
     auto ai = owner.getComponent<AIController>();
-    if (!ai) return;
+    if (!ai || !owner.hasComponent<sp::Transform>())
+        return false;
+    update_target_delay = random(0.25, 0.5);
+    updateRanges();
+
+    target_decision.orders = ai->orders;
+    target_decision.order_target_location = ai->order_target_location;
+    target_decision.order_target = ai->order_target;
+    auto target = owner.getComponent<Target>();
+    target_decision.current_target = target ? target->entity : sp::ecs::Entity{};
+    target_decision.beams.clear();
+    if (auto beamsystem = owner.getComponent<BeamWeaponSys>())
+        for(auto& mount : beamsystem->mounts)
+            target_decision.beams.push_back({mount.direction, mount.arc, mount.range});
+    target_decision.pending = true;
+    return true;
+}
+
+void ShipAI::decideTarget(const AISnapshot& snapshot)
+{
+    auto& d = target_decision;
+    d.lost_target_in_nebula = false;
+    auto self = snapshot.find(owner);
+    if (!self)
+    {
+        d.pending = false;
+        return;
+    }
+    auto position = self->position;
+    sp::ecs::Entity target = d.current_target;
+    sp::ecs::Entity new_target;
+    auto target_object = snapshot.find(target);
 
     // Check if we lost our target because it entered a nebula.
-    if (target && RadarBlockSystem::isRadarBlockedFrom(position, target, short_range))
+    if (target_object && snapshot.isRadarBlockedFrom(position, *target_object, short_range))
     {
         // When we're roaming, and we lost our target in a nebula, set the
         // "fly to" position to the last known position of the enemy target.
-        if (ai->orders == AIOrder::Roaming)
+        if (d.orders == AIOrder::Roaming)
         {
-            ai->orders = AIOrder::Roaming;
-            auto tt = target.getComponent<sp::Transform>();
-            if (tt)
-                ai->order_target_location = tt->getPosition();
+            d.lost_target_in_nebula = true;
+            d.lost_target_position = target_object->position;
         }
 
         target = {};
     }
 
-    // If the target is no longer an enemy, clear the target.
-    if (target && Faction::getRelation(owner, target) != FactionRelation::Enemy)
+    // If the target is no longer an enemy, or no longer exists, clear the target.
+    if (target && (!target_object || snapshot.getRelation(*self, *target_object) != FactionRelation::Enemy))
         target = {};
 
     // If we're roaming, select the best target within long-range radar range.
-    if (ai->orders == AIOrder::Roaming)
+    // Without any target in long-range radar range, look for targets within relay range.
+    if (d.orders == AIOrder::Roaming)
     {
         if (target)
-            new_target = findBestTarget(position, short_range + 2000.0f);
+            new_target = findBestTarget(snapshot, *self, position, short_range + 2000.0f);
         else
-            new_target = findBestTarget(position, long_range);
+            new_target = findBestTarget(snapshot, *self, position, long_range);
+        if (!target && !new_target && (has_missiles || has_beams))
+            new_target = findBestTarget(snapshot, *self, position, relay_range);
     }
 
     // If we're holding ground or flying toward a destination, select only
     // targets within 2U of our short-range radar range.
-    if (ai->orders == AIOrder::StandGround || ai->orders == AIOrder::FlyTowards)
+    if (d.orders == AIOrder::StandGround || d.orders == AIOrder::FlyTowards)
     {
-        new_target = findBestTarget(position, short_range + 2000.0f);
+        new_target = findBestTarget(snapshot, *self, position, short_range + 2000.0f);
     }
 
     // If we're defending a position, select only targets within 2U of our
     // short-range radar range.
-    if (ai->orders == AIOrder::DefendLocation)
+    if (d.orders == AIOrder::DefendLocation)
     {
-        new_target = findBestTarget(ai->order_target_location, short_range + 2000.0f);
+        new_target = findBestTarget(snapshot, *self, d.order_target_location, short_range + 2000.0f);
     }
 
     // If we're flying in formation, select targets only within short-range
     // radar range.
-    if (ai->orders == AIOrder::FlyFormation && ai->order_target)
+    if (d.orders == AIOrder::FlyFormation && d.order_target)
     {
-        auto order_target_target = ai->order_target.getComponent<Target>();
-
-        if (order_target_target) {
-            if (auto ottt = order_target_target->entity.getComponent<sp::Transform>()) {
-                if (glm::length2(ottt->getPosition() - position) < short_range*short_range) {
-                    new_target = order_target_target->entity;
+        auto leader = snapshot.find(d.order_target);
+        if (leader && leader->target) {
+            if (auto leader_target = snapshot.find(leader->target)) {
+                if (glm::length2(leader_target->position - position) < short_range*short_range) {
+                    new_target = leader_target->entity;
                 }
             }
         }
@@ -316,44 +350,43 @@ void ShipAI::updateTarget()
 
     // If we're defending a target, select only targets within 2U of our
     // short-range radar range.
-    if (ai->orders == AIOrder::DefendTarget && ai->order_target)
+    if (d.orders == AIOrder::DefendTarget && d.order_target)
     {
-        auto ott = ai->order_target.getComponent<sp::Transform>();
-        if (ott)
-            new_target = findBestTarget(ott->getPosition(), short_range + 2000.0f);
+        if (auto defend = snapshot.find(d.order_target))
+            new_target = findBestTarget(snapshot, *self, defend->position, short_range + 2000.0f);
     }
 
-    if (ai->orders == AIOrder::Attack)
+    if (d.orders == AIOrder::Attack)
     {
-        new_target = ai->order_target;
+        new_target = d.order_target;
     }
 
     // Check if we need to drop the current target.
-    if (auto tt = target.getComponent<sp::Transform>())
+    if (target)
     {
-        float target_distance = glm::length(tt->getPosition() - position);
+        float target_distance = glm::length(target_object->position - position);
 
         // Release the target if it moves more than short-range radar range +
         // 3U away from us or our destination.
-        if ((ai->orders == AIOrder::StandGround
-            || ai->orders == AIOrder::DefendLocation
-            || ai->orders == AIOrder::DefendTarget
-            || ai->orders == AIOrder::FlyTowards) && (target_distance > short_range + 3000.0f))
+        if ((d.orders == AIOrder::StandGround
+            || d.orders == AIOrder::DefendLocation
+            || d.orders == AIOrder::DefendTarget
+            || d.orders == AIOrder::FlyTowards) && (target_distance > short_range + 3000.0f))
         {
             target = {};
         }
 
         // If we're flying in formation, release the target if it moves more
         // than short-range radar range + 1U away from us.
-        if (ai->orders == AIOrder::FlyFormation && target_distance > short_range + 1000.0f)
+        if (d.orders == AIOrder::FlyFormation && target_distance > short_range + 1000.0f)
         {
             target = {};
         }
 
         // Don't target anything if we're idling, flying blind, or docking.
-        if (ai->orders == AIOrder::Idle
-            || ai->orders == AIOrder::FlyTowardsBlind
-            || ai->orders == AIOrder::Dock)
+        if (d.orders == AIOrder::Idle
+            || d.orders == AIOrder::FlyTowardsBlind
+            || d.orders == AIOrder::Dock)
         {
             target = {};
         }
@@ -362,21 +395,36 @@ void ShipAI::updateTarget()
     // Check if we want to switch to a new target.
     if (new_target)
     {
-        if (!target || betterTarget(new_target, target))
+        if (!target || betterTarget(snapshot, *self, new_target, target))
         {
             target = new_target;
         }
     }
+    d.target = target;
+}
+
+void ShipAI::applyTargetDecision()
+{
+    if (!target_decision.pending)
+        return;
+    target_decision.pending = false;
+
+    if (target_decision.lost_target_in_nebula)
+    {
+        auto ai = owner.getComponent<AIController>();
+        if (ai && ai->orders == AIOrder::Roaming)
+            ai->order_target_location = target_decision.lost_target_position;
+    }
 
     // If we still don't have a target, set that on the owner.
-    if (!target)
+    if (!target_decision.target)
     {
         owner.removeComponent<Target>();
     }
     // Otherwise, set the new target on the owner.
     else
     {
-        owner.getOrAddComponent<Target>().entity = target;
+        owner.getOrAddComponent<Target>().entity = target_decision.target;
     }
 }
 
@@ -402,18 +450,13 @@ void ShipAI::runOrders()
         if (auto ot = owner.getComponent<sp::Transform>()) {
             if (has_missiles || has_beams)
             {
-                auto new_target = findBestTarget(ot->getPosition(), relay_range);
-                if (new_target)
-                {
-                    owner.getOrAddComponent<Target>().entity = new_target;
-                }else{
-                    auto diff = ai->order_target_location - ot->getPosition();
-                    if (glm::length2(diff) < 1000.0f*1000.0f) {
-                        ai->orders = AIOrder::Roaming;
-                        ai->order_target_location = glm::vec2(random(-long_range, long_range), random(-long_range, long_range));
-                    }
-                    flyTowards(ai->order_target_location);
+                // Looking for targets within relay range is part of the target decision, so keep roaming until one is found.
+                auto diff = ai->order_target_location - ot->getPosition();
+                if (glm::length2(diff) < 1000.0f*1000.0f) {
+                    ai->orders = AIOrder::Roaming;
+                    ai->order_target_location = glm::vec2(random(-long_range, long_range), random(-long_range, long_range));
                 }
+                flyTowards(ai->order_target_location);
             }else{
                 auto tubes = owner.getComponent<MissileTubes>();
                 if (tubes && tubes->mounts.size() > 0)
@@ -759,51 +802,45 @@ void ShipAI::flyFormation(sp::ecs::Entity target, glm::vec2 offset)
     }
 }
 
-sp::ecs::Entity ShipAI::findBestTarget(glm::vec2 position, float radius)
+sp::ecs::Entity ShipAI::findBestTarget(const AISnapshot& snapshot, const AISnapshot::Object& self, glm::vec2 position, float radius)
 {
     float target_score = 0.0;
-    sp::ecs::Entity target;
-    auto ot = owner.getComponent<sp::Transform>();
-    auto owner_position = ot->getPosition();
-    for(auto entity : sp::CollisionSystem::queryArea(position - glm::vec2(radius, radius), position + glm::vec2(radius, radius)))
-    {
-        if (!entity.hasComponent<Hull>() || Faction::getRelation(owner, entity) != FactionRelation::Enemy || entity == target)
-            continue;
-        if (RadarBlockSystem::isRadarBlockedFrom(owner_position, entity, short_range))
-            continue;
-        float score = targetScore(entity);
+    const AISnapshot::Object* target = nullptr;
+    snapshot.queryArea(position, radius, [&](const AISnapshot::Object& object)
+    {
+        if (snapshot.getRelation(self, object) != FactionRelation::Enemy)
+            return;
+        if (snapshot.isRadarBlockedFrom(self.position, object, short_range))
+            return;
+        float score = targetScore(self, object);
         if (score == std::numeric_limits<float>::min())
-            continue;
+            return;
         if (!target || score > target_score)
         {
-            target = entity;
+            target = &object;
             target_score = score;
         }
-    }
-    return target;
+    });
+    if (!target)
+        return {};
+    return target->entity;
 }
 
-float ShipAI::targetScore(sp::ecs::Entity target)
+float ShipAI::targetScore(const AISnapshot::Object& self, const AISnapshot::Object& target)
 {
-    auto impulse = owner.getComponent<ImpulseEngine>();
-    auto ot = owner.getComponent<sp::Transform>();
-    if (!ot) return std::numeric_limits<float>::min();
-    auto tt = target.getComponent<sp::Transform>();
-    if (!tt) return std::numeric_limits<float>::min();
-    auto position_difference = tt->getPosition() - ot->getPosition();
+    auto position_difference = target.position - self.position;
     float distance = glm::length(position_difference);
     //auto position_difference_normal = position_difference / distance;
     //float rel_velocity = dot(target->getVelocity(), position_difference_normal) - dot(getVelocity(), position_difference_normal);
-    float angle_difference = angleDifference(ot->getRotation(), vec2ToAngle(position_difference));
-    auto thrusters = owner.getComponent<ManeuveringThrusters>();
-    float score = -distance - std::abs(angle_difference / (thrusters ? thrusters->speed : 10.0f) * (impulse ? impulse->max_speed_forward : 0.0f)) * 1.5f;
-    if (target.hasComponent<BeamWeaponSys>())
+    float angle_difference = angleDifference(self.rotation, vec2ToAngle(position_difference));
+    float score = -distance - std::abs(angle_difference / self.turn_speed * self.max_speed_forward) * 1.5f;
+    if (target.flags & AISnapshot::Object::HasBeams)
         score += 2500;
-    if (target.hasComponent<MissileTubes>())
+    if (target.flags & AISnapshot::Object::HasMissileTubes)
         score += 2500;
-    if (target.hasComponent<DockingBay>())
+    if (target.flags & AISnapshot::Object::HasDockingBay)
         score -= 1500;
-    if (target.hasComponent<AllowRadarLink>())
+    if (target.flags & AISnapshot::Object::AllowRadarLink)
     {
         score -= 10000;
         if (distance > 5000)
@@ -814,23 +851,22 @@ float ShipAI::targetScore(sp::ecs::Entity target)
 
     if (distance < beam_weapon_range)
     {
-        auto beamsystem = owner.getComponent<BeamWeaponSys>();
-        if (beamsystem) {
-            for(auto& mount : beamsystem->mounts) {
-                if (distance < mount.range) {
-                    if (fabs(angleDifference(angle_difference, mount.direction)) < mount.arc / 2.0f)
-                        score += 1000;
-                }
+        for(auto& beam : target_decision.beams) {
+            if (distance < beam.range) {
+                if (fabs(angleDifference(angle_difference, beam.direction)) < beam.arc / 2.0f)
+                    score += 1000;
             }
         }
     }
     return score;
 }
 
-bool ShipAI::betterTarget(sp::ecs::Entity new_target, sp::ecs::Entity current_target)
+bool ShipAI::betterTarget(const AISnapshot& snapshot, const AISnapshot::Object& self, sp::ecs::Entity new_target, sp::ecs::Entity current_target)
 {
-    float new_score = targetScore(new_target);
-    float current_score = targetScore(current_target);
+    auto new_object = snapshot.find(new_target);
+    auto current_object = snapshot.find(current_target);
+    float new_score = new_object ? targetScore(self, *new_object) : std::numeric_limits<float>::min();
+    float current_score = current_object ? targetScore(self, *current_object) : std::numeric_limits<float>::min();
 
     // Ignore targets if their score is the lowest possible value.
     if (new_score == std::numeric_limits<float>::min())
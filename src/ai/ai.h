@@ -5,6 +5,8 @@
 #include "graphics/renderTarget.h"
 #include "systems/pathfinding.h"
 #include "components/missiletubes.h"
+#include "components/ai.h"
+#include "ai/aiSnapshot.h"
 
 ///Forward declaration
 class CpuShip;
@@ -39,11 +41,48 @@ protected:
     EMissileWeapons best_missile_type;
 
     float update_target_delay;
+    // Time passed since the last updateWeaponState, as that can be skipped on frames without an expensive update.
+    float weapon_state_delta = 0.0f;
 
     PathPlanner pathPlanner;
+
+    /**!
+     * Input and result of the target decision. The input is copied from our own components by prepareTargetDecision,
+     * so decideTarget only needs this and the snapshot.
+     */
+    struct TargetDecision
+    {
+        struct BeamArc
+        {
+            float direction;
+            float arc;
+            float range;
+        };
+
+        bool pending = false;
+        AIOrder orders;
+        glm::vec2 order_target_location;
+        sp::ecs::Entity order_target;
+        sp::ecs::Entity current_target;
+        std::vector<BeamArc> beams;
+
+        sp::ecs::Entity target;
+        bool lost_target_in_nebula = false;
+        glm::vec2 lost_target_position;
+    } target_decision;
 public:
     sp::ecs::Entity owner;
 
+    /**!
+     * Set by the AISystem before calling run. When false, the AI should only steer and follow orders,
+     * and skip the expensive weapon state update for this frame.
+     */
+    bool allow_expensive_update = true;
+    /**!
+     * Time since the last frame that allowed an expensive update, used by the AISystem for scheduling.
+     */
+    float expensive_update_age = 0.0f;
+
     ShipAI(sp::ecs::Entity owner);
     virtual ~ShipAI() = default;
 
@@ -58,18 +97,29 @@ public:
      */
     virtual bool canSwitchAI();
 
+    /**!
+     * Target selection is split in 3 phases, so the AISystem can run the expensive decision for many AIs in parallel.
+     * prepareTargetDecision runs on the main thread and returns true if we want to select a new target this frame.
+     * decideTarget can run on any thread, and should only read from the snapshot and the prepared decision.
+     * applyTargetDecision runs on the main thread again and sets the new target.
+     */
+    bool prepareTargetDecision(float delta);
+    void decideTarget(const AISnapshot& snapshot);
+    void applyTargetDecision();
+
 
     virtual void drawOnGMRadar(sp::RenderTarget& renderer, glm::vec2 draw_position, float scale);
 protected:
     virtual void updateWeaponState(float delta);
-    virtual void updateTarget();
     virtual void runOrders();
     virtual void runAttack(sp::ecs::Entity target);
     virtual void flyTowards(glm::vec2 target, float keep_distance = 100.0);
     virtual void flyFormation(sp::ecs::Entity target, glm::vec2 offset);
 
-    sp::ecs::Entity findBestTarget(glm::vec2 position, float radius);
-    float targetScore(sp::ecs::Entity target);
+    void updateRanges();
+
+    sp::ecs::Entity findBestTarget(const AISnapshot& snapshot, const AISnapshot::Object& self, glm::vec2 position, float radius);
+    float targetScore(const AISnapshot::Object& self, const AISnapshot::Object& target);
 
     /**!
      * Check if new target is better than old target.
@@ -77,7 +127,7 @@ protected:
      * \param current_target
      * \return bool True if the new target is 'better'
      */
-    bool betterTarget(sp::ecs::Entity new_target, sp::ecs::Entity current_target);
+    bool betterTarget(const AISnapshot& snapshot, const AISnapshot::Object& self, sp::ecs::Entity new_target, sp::ecs::Entity current_target);
 
     /**!
      * Used for missiles, as they require some intelligence to fire.
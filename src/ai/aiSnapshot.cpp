@@ -0,0 +1,87 @@
+#include "ai/aiSnapshot.h"
+#include "components/collision.h"
+#include "components/hull.h"
+#include "components/beamweapon.h"
+#include "components/missiletubes.h"
+#include "components/docking.h"
+#include "components/radar.h"
+#include "components/radarblock.h"
+#include "components/target.h"
+#include "components/impulse.h"
+#include "components/maneuveringthrusters.h"
+#include "systems/radarblock.h"
+#include "ecs/query.h"
+
+
+void AISnapshot::prepare()
+{
+    Faction::updateRelationMatrix();
+    // Make sure the radar block queries do not need to modify anything when they are used from the decision phase.
+    RadarBlockSystem::updateIndex();
+}
+
+void AISnapshot::build()
+{
+    clear();
+    built = true;
+    // Objects store the index of their faction in the relation matrix, so the relation lookup does not touch any components.
+    relation_matrix_generation = Faction::getRelationMatrixGeneration();
+
+    for(auto [entity, transform] : sp::ecs::Query<sp::Transform>()) {
+        Object object;
+        object.entity = entity;
+        object.position = transform.getPosition();
+        object.rotation = transform.getRotation();
+        object.flags = 0;
+        if (entity.hasComponent<Hull>()) object.flags |= Object::HasHull;
+        if (entity.hasComponent<BeamWeaponSys>()) object.flags |= Object::HasBeams;
+        if (entity.hasComponent<MissileTubes>()) object.flags |= Object::HasMissileTubes;
+        if (entity.hasComponent<DockingBay>()) object.flags |= Object::HasDockingBay;
+        if (entity.hasComponent<AllowRadarLink>()) object.flags |= Object::AllowRadarLink;
+        if (entity.hasComponent<NeverRadarBlocked>()) object.flags |= Object::NeverRadarBlocked;
+        object.faction = Faction::getRelationIndex(entity);
+        auto target = entity.getComponent<Target>();
+        if (target)
+            object.target = target->entity;
+        auto thrusters = entity.getComponent<ManeuveringThrusters>();
+        object.turn_speed = thrusters ? thrusters->speed : 10.0f;
+        auto impulse = entity.getComponent<ImpulseEngine>();
+        object.max_speed_forward = impulse ? impulse->max_speed_forward : 0.0f;
+
+        auto index = entity.getIndex();
+        if (index >= lookup.size())
+            lookup.resize(index + 1, -1);
+        lookup[index] = int(objects.size());
+        if (object.flags & Object::HasHull)
+            cells[cellKey(cellCoord(object.position.x), cellCoord(object.position.y))].push_back(uint32_t(objects.size()));
+        objects.push_back(object);
+    }
+}
+
+void AISnapshot::clear()
+{
+    objects.clear();
+    std::fill(lookup.begin(), lookup.end(), -1);
+    for(auto& it : cells)
+        it.second.clear();
+}
+
+const AISnapshot::Object* AISnapshot::find(sp::ecs::Entity entity) const
+{
+    if (!entity)
+        return nullptr;
+    auto index = entity.getIndex();
+    if (index >= lookup.size() || lookup[index] < 0)
+        return nullptr;
+    auto& object = objects[lookup[index]];
+    if (object.entity != entity)
+        return nullptr;
+    return &object;
+}
+
+bool AISnapshot::isRadarBlockedFrom(glm::vec2 source, const Object& object, float short_range) const
+{
+    if (object.flags & Object::NeverRadarBlocked)
+        return false;
+    return RadarBlockSystem::isRadarBlockedBetween(source, object.position, short_range);
+}
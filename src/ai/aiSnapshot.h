@@ -0,0 +1,88 @@
+#ifndef AI_SNAPSHOT_H
+#define AI_SNAPSHOT_H
+
+#include "ecs/entity.h"
+#include "components/faction.h"
+#include <glm/vec2.hpp>
+#include <vector>
+#include <cmath>
+#include <unordered_map>
+
+/**!
+ * Read-only copy of the world state that the AI decision phase needs.
+ * It is build on the main thread, after that the decision phase reads from it from multiple threads,
+ *  so it must not be modified and the decision phase must not touch the components of other entities.
+ * Building walks all entities, so the AISystem reuses a snapshot for a few frames. Before every decision phase
+ *  prepare has to be called, and the snapshot has to be rebuild if it is outdated.
+ */
+class AISnapshot
+{
+public:
+    struct Object
+    {
+        static constexpr uint32_t HasHull = 1 << 0;
+        static constexpr uint32_t HasBeams = 1 << 1;
+        static constexpr uint32_t HasMissileTubes = 1 << 2;
+        static constexpr uint32_t HasDockingBay = 1 << 3;
+        static constexpr uint32_t AllowRadarLink = 1 << 4;
+        static constexpr uint32_t NeverRadarBlocked = 1 << 5;
+
+        sp::ecs::Entity entity;
+        glm::vec2 position;
+        float rotation;
+        uint32_t flags;
+        // Index in the faction relation matrix.
+        int faction;
+        // Current target of this object, if it has one.
+        sp::ecs::Entity target;
+        float turn_speed;
+        float max_speed_forward;
+    };
+
+    // Update the shared state the decision phase reads besides the snapshot: the faction relation matrix and the radar block index.
+    static void prepare();
+    // Call prepare first.
+    void build();
+    void clear();
+    // True if the snapshot was never build, or the faction relation indices it holds are from an older relation matrix.
+    bool isOutdated() const { return !built || relation_matrix_generation != Faction::getRelationMatrixGeneration(); }
+
+    const Object* find(sp::ecs::Entity entity) const;
+    // Call the function for every object with a hull within the square area around the position.
+    template<typename F> void queryArea(glm::vec2 position, float radius, const F& func) const
+    {
+        int x0 = cellCoord(position.x - radius);
+        int x1 = cellCoord(position.x + radius);
+        int y0 = cellCoord(position.y - radius);
+        int y1 = cellCoord(position.y + radius);
+        for(int x=x0; x<=x1; x++) {
+            for(int y=y0; y<=y1; y++) {
+                auto it = cells.find(cellKey(x, y));
+                if (it == cells.end())
+                    continue;
+                for(auto index : it->second) {
+                    auto& object = objects[index];
+                    if (std::abs(object.position.x - position.x) <= radius && std::abs(object.position.y - position.y) <= radius)
+                        func(object);
+                }
+            }
+        }
+    }
+    FactionRelation getRelation(const Object& a, const Object& b) const { return Faction::getRelationByIndex(a.faction, b.faction); }
+    bool isRadarBlockedFrom(glm::vec2 source, const Object& object, float short_range) const;
+
+private:
+    static constexpr float cell_size = 5000.0f;
+
+    std::vector<Object> objects;
+    // Entity index to object index, -1 for entities that are not in the snapshot.
+    std::vector<int> lookup;
+    std::unordered_map<uint64_t, std::vector<uint32_t>> cells;
+    bool built = false;
+    uint32_t relation_matrix_generation = 0;
+
+    static uint64_t cellKey(int x, int y) { return (uint64_t(uint32_t(x)) << 32) | uint64_t(uint32_t(y)); }
+    static int cellCoord(float f) { return int(std::floor(f / cell_size)); }
+};
+
+#endif//AI_SNAPSHOT_H
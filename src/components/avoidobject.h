@@ -15,7 +15,8 @@ public:
         BigEntity,
         SmallEntity,
     } state = InternalState::New;
-    uint32_t position_hash = 0;
+    uint64_t cell = 0;  // Grid cell we are stored in, for small entities.
+    uint32_t slot = 0;  // Index in the list of our grid cell (or the big entity list), for O(1) removal.
 };
 
 class DelayedAvoidObject
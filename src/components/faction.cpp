@@ -3,6 +3,11 @@
 
 
 static FactionInfo default_faction_info;
+std::vector<FactionRelation> Faction::relation_matrix{FactionRelation::Neutral};
+int Faction::relation_matrix_size = 1;
+bool Faction::relation_matrix_valid = false;
+uint32_t Faction::relation_matrix_generation = 0;
+std::vector<Faction::RelationSource> Faction::relation_sources;
 
 
 sp::ecs::Entity Faction::find(const string& name)
@@ -27,11 +32,92 @@ FactionInfo& Faction::getInfo(sp::ecs::Entity entity)
 
 FactionRelation Faction::getRelation(sp::ecs::Entity a, sp::ecs::Entity b)
 {
-    auto fia = Faction::getInfo(a);
-    auto fb = b.getComponent<Faction>();
-    if (fb)
-        return fia.getRelation(fb->entity);
-    return fia.getRelation({});
+    if (!relation_matrix_valid)
+        buildRelationMatrix();
+    auto index_a = getRelationIndex(a);
+    auto index_b = getRelationIndex(b);
+    if (index_a < 0 || index_b < 0)
+    {
+        buildRelationMatrix();
+        index_a = getRelationIndex(a);
+        index_b = getRelationIndex(b);
+    }
+    return getRelationByIndex(index_a, index_b);
+}
+
+int Faction::getRelationIndex(sp::ecs::Entity entity)
+{
+    auto faction = entity.getComponent<Faction>();
+    if (!faction)
+        return relation_matrix_size - 1;
+    auto info = faction->entity.getComponent<FactionInfo>();
+    if (!info)
+        return relation_matrix_size - 1;
+    if (info->relation_index >= relation_matrix_size - 1)
+        return -1;
+    return info->relation_index;
+}
+
+void Faction::updateRelationMatrix()
+{
+    if (!relation_matrix_valid)
+    {
+        buildRelationMatrix();
+        return;
+    }
+    // There are only a handful of factions, so comparing all relation lists each frame is cheap.
+    size_t index = 0;
+    for(auto [entity, info] : sp::ecs::Query<FactionInfo>())
+    {
+        if (index >= relation_sources.size() || relation_sources[index].faction != entity || info.relation_index != int(index))
+        {
+            buildRelationMatrix();
+            return;
+        }
+        auto& source = relation_sources[index].relations;
+        if (source.size() != info.relations.size())
+        {
+            buildRelationMatrix();
+            return;
+        }
+        for(size_t n=0; n<source.size(); n++)
+        {
+            if (source[n].first != info.relations[n].other_faction || source[n].second != info.relations[n].relation)
+            {
+                buildRelationMatrix();
+                return;
+            }
+        }
+        index++;
+    }
+    if (index != relation_sources.size())
+        buildRelationMatrix();
+}
+
+void Faction::buildRelationMatrix()
+{
+    relation_sources.clear();
+    for(auto [entity, info] : sp::ecs::Query<FactionInfo>())
+    {
+        info.relation_index = int(relation_sources.size());
+        RelationSource source{entity, {}};
+        for(auto& relation : info.relations)
+            source.relations.emplace_back(relation.other_faction, relation.relation);
+        relation_sources.push_back(std::move(source));
+    }
+
+    // The extra last row and column are for entities without a faction.
+    relation_matrix_size = int(relation_sources.size()) + 1;
+    relation_matrix.assign(relation_matrix_size * relation_matrix_size, FactionRelation::Neutral);
+    for(int a=0; a<int(relation_sources.size()); a++)
+    {
+        auto info = relation_sources[a].faction.getComponent<FactionInfo>();
+        for(int b=0; b<int(relation_sources.size()); b++)
+            relation_matrix[a * relation_matrix_size + b] = info->getRelation(relation_sources[b].faction);
+        relation_matrix[a * relation_matrix_size + relation_matrix_size - 1] = info->getRelation({});
+    }
+    relation_matrix_valid = true;
+    relation_matrix_generation++;
 }
 
 // TODO: Info about multiple components belongs in systems, not in component code.
@@ -61,7 +147,7 @@ void Faction::didAnOffensiveAction(sp::ecs::Entity entity)
 
 FactionRelation FactionInfo::getRelation(sp::ecs::Entity faction_entity)
 {
-    for(auto it : relations)
+    for(auto& it : relations)
         if (it.other_faction == faction_entity)
             return it.relation;
     return FactionRelation::Neutral;
@@ -73,11 +159,13 @@ void FactionInfo::setRelation(sp::ecs::Entity faction_entity, FactionRelation re
         if (it.other_faction == faction_entity) {
             it.relation = relation;
             relations_dirty = true;
+            Faction::invalidateRelationMatrix();
             return;
         }
     }
     relations.push_back({faction_entity, relation});
     relations_dirty = true;
+    Faction::invalidateRelationMatrix();
 }
 
 FactionInfo* FactionInfo::find(const string& name)
@@ -25,6 +25,32 @@ public:
     static FactionRelation getRelation(sp::ecs::Entity a, sp::ecs::Entity b);
 
     static void didAnOffensiveAction(sp::ecs::Entity entity);
+
+    // Relations between all factions are kept in a matrix, indexed by the relation_index of the FactionInfo,
+    //  so getRelation does not need to search the relation lists.
+    // updateRelationMatrix checks if any faction or relation changed and rebuilds the matrix if needed. This is done once per frame,
+    //  changes made with FactionInfo::setRelation are picked up right away.
+    static void updateRelationMatrix();
+    // Index of the faction of this entity in the relation matrix. Entities without a faction use the last index.
+    //  Returns -1 for a faction that was created after the matrix was build.
+    static int getRelationIndex(sp::ecs::Entity entity);
+    static FactionRelation getRelationByIndex(int a, int b) { return relation_matrix[a * relation_matrix_size + b]; }
+    static void invalidateRelationMatrix() { relation_matrix_valid = false; }
+    // Increases every time the matrix is rebuild, relation indices from an older generation are no longer valid.
+    static uint32_t getRelationMatrixGeneration() { return relation_matrix_generation; }
+private:
+    static std::vector<FactionRelation> relation_matrix;
+    static int relation_matrix_size;
+    static bool relation_matrix_valid;
+    static uint32_t relation_matrix_generation;
+    // Copy of the relation lists the matrix was build from, to detect changes that did not go trough setRelation.
+    struct RelationSource {
+        sp::ecs::Entity faction;
+        std::vector<std::pair<sp::ecs::Entity, FactionRelation>> relations;
+    };
+    static std::vector<RelationSource> relation_sources;
+
+    static void buildRelationMatrix();
 };
 
 class FactionInfo
@@ -43,6 +69,8 @@ public:
     };
     bool relations_dirty = true;
     std::vector<Relation> relations;
+    // Index in the relation matrix, not replicated.
+    int relation_index = -1;
 
     FactionRelation getRelation(sp::ecs::Entity faction_entity);
     void setRelation(sp::ecs::Entity faction_entity, FactionRelation relation);
@@ -5,7 +5,7 @@
 Mesh* MeshRenderComponent::getMesh()
 {
     if (!mesh.ptr && !mesh.name.empty())
-        mesh.ptr = Mesh::getMesh(mesh.name);
+        mesh.ptr = Mesh::getMeshAsync(mesh.name);
     return mesh.ptr;
 }
 
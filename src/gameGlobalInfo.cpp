@@ -8,10 +8,12 @@
 #include "random.h"
 #include "config.h"
 #include "components/collision.h"
+#include "components/rendering.h"
 #include "systems/collision.h"
 #include "ecs/query.h"
 #include "menus/luaConsole.h"
 #include "playerInfo.h"
+#include "scriptProfiler.h"
 #include <SDL_assert.h>
 
 P<GameGlobalInfo> gameGlobalInfo;
@@ -103,6 +105,7 @@ void GameGlobalInfo::update(float delta)
     elapsed_time += delta;
 
     if (main_scenario_script && main_script_error_count < max_repeated_script_errors) {
+        ScriptProfiler::Scope scope("update");
         auto res = main_scenario_script->call<void>("update", delta);
         if (res.isErr() && res.error() != "Not a function") {
             LuaConsole::checkResult(res);
@@ -115,6 +118,7 @@ void GameGlobalInfo::update(float delta)
         }
     }
     for(auto& as : additional_scripts) {
+        ScriptProfiler::Scope scope("update (additional script)");
         auto res = as->call<void>("update", delta);
         if (res.isErr() && res.error() != "Not a function")
             LuaConsole::checkResult(res);
@@ -243,7 +247,6 @@ void GameGlobalInfo::reset()
     sp::ecs::Entity::destroyAllEntities();
     main_scenario_script = nullptr;
     additional_scripts.clear();
-    script_environment_base = nullptr;
 
     elapsed_time = 0.0f;
     callsign_counter = 0;
@@ -300,32 +303,23 @@ void GameGlobalInfo::startScenario(string filename, std::unordered_map<string, s
 {
     reset();
 
+    ScriptProfiler::reset();
+
     i18n::reset();
     i18n::load("locale/main." + PreferencesManager::get("language", "en") + ".po");
     i18n::load("locale/comms_ship." + PreferencesManager::get("language", "en") + ".po");
     i18n::load("locale/comms_station." + PreferencesManager::get("language", "en") + ".po");
     i18n::load("locale/factionInfo." + PreferencesManager::get("language", "en") + ".po");
     i18n::load("locale/science_db." + PreferencesManager::get("language", "en") + ".po");
-    i18n::load("locale/" + filename.replace(".lua", "." + PreferencesManager::get("language", "en") + ".po"));
 
-    script_environment_base = std::make_unique<sp::script::Environment>();
+    // Running the base scripts takes most of the time of a scenario start, so their result is kept and restored
+    //  when the next scenario starts with the same language. The translations are applied when the scripts run.
+    auto language = PreferencesManager::get("language", "en");
     main_script_error_count = 0;
-    if (setupScriptEnvironment(*script_environment_base.get())) {
-        auto res = script_environment_base->runFile<void>("model_data.lua");
-        LuaConsole::checkResult(res);
-        if (!res.isErr()) {
-            res = script_environment_base->runFile<void>("factionInfo.lua");
-            LuaConsole::checkResult(res);
-        }
-        if (!res.isErr()) {
-            res = script_environment_base->runFile<void>("shipTemplates.lua");
-            LuaConsole::checkResult(res);
-        }
-        if (!res.isErr()) {
-            res = script_environment_base->runFile<void>("science_db.lua");
-            LuaConsole::checkResult(res);
-        }
-    }
+    if (script_environment_base && base_language == language && PreferencesManager::get("reuse_script_base", "1").toInt())
+        restoreScriptEnvironmentBase();
+    else
+        loadScriptEnvironmentBase(language);
 
     main_scenario_script = std::make_unique<sp::script::Environment>(script_environment_base.get());
     setupSubEnvironment(*main_scenario_script.get());
@@ -336,7 +330,8 @@ void GameGlobalInfo::startScenario(string filename, std::unordered_map<string, s
     // Initialize scenario settings.
     setScenarioSettings(filename, new_settings);
 
-    auto res = main_scenario_script->runFile<void>(filename);
+    // Through require, so the compiled script can come from the script cache. It also loads the translations of the scenario.
+    auto res = main_scenario_script->call<void>("require", filename);
     LuaConsole::checkResult(res);
     if (res.isOk() && main_scenario_script->isFunction("init")) {
         res = main_scenario_script->call<void>("init");
@@ -347,6 +342,14 @@ void GameGlobalInfo::startScenario(string filename, std::unordered_map<string, s
         }
     }
 
+    // Start loading the meshes of everything the scenario created, so they are ready when they come into view.
+    if (PreferencesManager::get("headless") == "")
+    {
+        for(auto [entity, mrc] : sp::ecs::Query<MeshRenderComponent>())
+            if (!mrc.mesh.name.empty())
+                Mesh::prefetch(mrc.mesh.name);
+    }
+
     if (PreferencesManager::get("game_logs", "1").toInt())
     {
         state_logger = new GameStateLogger();
@@ -354,9 +357,102 @@ void GameGlobalInfo::startScenario(string filename, std::unordered_map<string, s
     }
 }
 
+void GameGlobalInfo::loadScriptEnvironmentBase(const string& language)
+{
+    script_environment_base = std::make_unique<sp::script::Environment>();
+    base_entities.clear();
+    base_language = "";
+    if (!setupScriptEnvironment(*script_environment_base.get()))
+        return;
+    for(auto filename : {"model_data.lua", "factionInfo.lua", "shipTemplates.lua", "science_db.lua"})
+    {
+        auto res = script_environment_base->runFile<void>(filename);
+        LuaConsole::checkResult(res);
+        if (res.isErr())
+            return;
+    }
+    auto res = script_environment_base->call<void>("__snapshotBaseEnvironment");
+    LuaConsole::checkResult(res);
+    if (res.isErr())
+        return;
+
+    std::unordered_map<uint32_t, size_t> positions;
+    auto add = [this, &positions](sp::ecs::Entity entity) -> BaseEntity& {
+        auto [it, inserted] = positions.emplace(entity.getIndex(), base_entities.size());
+        if (inserted)
+            base_entities.push_back({entity});
+        return base_entities[it->second];
+    };
+    for(auto [entity, info] : sp::ecs::Query<FactionInfo>())
+    {
+        auto& base = add(entity);
+        base.faction_info = info;
+        base.faction_info->relation_index = -1;
+    }
+    for(auto [entity, database] : sp::ecs::Query<Database>())
+    {
+        auto& base = add(entity);
+        base.database = database;
+        if (auto mrc = entity.getComponent<MeshRenderComponent>())
+            base.mesh_render = *mrc;
+    }
+    base_language = language;
+}
+
+void GameGlobalInfo::restoreScriptEnvironmentBase()
+{
+    // All entities were destroyed by reset, create new ones and point the references between them to the new entities.
+    std::unordered_map<uint32_t, size_t> positions;
+    std::vector<sp::ecs::Entity> entities;
+    for(auto& base : base_entities)
+    {
+        positions[base.entity.getIndex()] = entities.size();
+        entities.push_back(sp::ecs::Entity::create());
+    }
+    auto remap = [this, &positions, &entities](sp::ecs::Entity entity) {
+        auto it = positions.find(entity.getIndex());
+        if (it == positions.end() || base_entities[it->second].entity != entity)
+            return sp::ecs::Entity{};
+        return entities[it->second];
+    };
+    for(size_t n=0; n<base_entities.size(); n++)
+    {
+        auto& base = base_entities[n];
+        auto entity = entities[n];
+        if (base.faction_info)
+        {
+            auto& info = entity.addComponent<FactionInfo>(*base.faction_info);
+            for(auto& relation : info.relations)
+                relation.other_faction = remap(relation.other_faction);
+        }
+        if (base.database)
+        {
+            auto& database = entity.addComponent<Database>(*base.database);
+            database.parent = remap(database.parent);
+        }
+        if (base.mesh_render)
+            entity.addComponent<MeshRenderComponent>(*base.mesh_render);
+    }
+    Faction::invalidateRelationMatrix();
+
+    auto res = script_environment_base->call<void>("__restoreBaseEnvironment");
+    LuaConsole::checkResult(res);
+    for(size_t n=0; n<base_entities.size() && res.isOk(); n++)
+    {
+        if (base_entities[n].faction_info)
+        {
+            res = script_environment_base->call<void>("__registerFactionInfo", entities[n]);
+            LuaConsole::checkResult(res);
+        }
+    }
+}
+
 void GameGlobalInfo::destroy()
 {
     reset();
+    script_environment_base = nullptr;
+    base_entities.clear();
+    base_language = "";
     MultiplayerObject::destroy();
 }
 
@@ -5,11 +5,14 @@
 #include "script/gm.h"
 #include "gameStateLogger.h"
 #include "components/faction.h"
+#include "components/database.h"
+#include "components/rendering.h"
 #include "Updatable.h"
 #include "multiplayer.h"
 #include <list>
 #include <functional>
 #include <unordered_map>
+#include <optional>
 
 
 class GameStateLogger;
@@ -128,6 +131,20 @@ private:
     int main_script_error_count = 0;
     static constexpr int max_repeated_script_errors = 5;
 
+    // The base environment is loaded once and restored for every following scenario start, see startScenario.
+    //  The base scripts only create faction and science database entities, these are kept as copies of their components.
+    struct BaseEntity {
+        sp::ecs::Entity entity; // The entity as originally created, references in the components point to these.
+        std::optional<FactionInfo> faction_info;
+        std::optional<Database> database;
+        std::optional<MeshRenderComponent> mesh_render;
+    };
+    std::vector<BaseEntity> base_entities;
+    string base_language; // Language the base environment was loaded with, empty if it cannot be reused.
+
+    void loadScriptEnvironmentBase(const string& language);
+    void restoreScriptEnvironmentBase();
+
     constexpr static int16_t CMD_PLAY_CLIENT_SOUND = 0x0001;
 };
 
@@ -0,0 +1,342 @@
+#include <algorithm>
+#include <unordered_set>
+
+#include "gameReplay.h"
+#include "engine.h"
+#include "ecs/query.h"
+#include "components/collision.h"
+#include "components/hull.h"
+#include "components/shields.h"
+#include "components/name.h"
+#include "components/faction.h"
+#include "components/radar.h"
+#include "components/beamweapon.h"
+#include "components/rendering.h"
+
+P<GameReplay> game_replay;
+
+
+GameReplay::GameReplay()
+{
+    game_replay = this;
+}
+
+GameReplay::~GameReplay()
+{
+    close();
+}
+
+bool GameReplay::open(const string& filename)
+{
+    close();
+
+    file.open(filename, std::ios::binary);
+    if (!file.is_open())
+    {
+        LOG(WARNING) << "Failed to open game state log for replay: " << filename;
+        return false;
+    }
+
+    // Build the index, we only need the type and time of each entry for this, so avoid parsing the full json.
+    while(true)
+    {
+        auto offset = file.tellg();
+        if (!std::getline(file, line))
+            break;
+        auto time_start = line.find("\"time\":");
+        if (time_start == std::string::npos)
+            continue;
+        bool keyframe = line.compare(0, 19, "{\"type\":\"keyframe\",") == 0;
+        if (keyframe)
+            keyframes.push_back(index.size());
+        index.push_back({offset, strtof(line.c_str() + time_start + 7, nullptr), keyframe});
+    }
+    file.clear();
+
+    if (keyframes.empty())
+    {
+        LOG(WARNING) << "Game state log has no keyframes, cannot replay: " << filename;
+        close();
+        return false;
+    }
+    LOG(INFO) << "Opened game state log for replay: " << filename << " " << index.size() << " entries, " << getDuration() << " seconds";
+    seek(0.0f);
+    return true;
+}
+
+void GameReplay::close()
+{
+    clearEntities();
+    if (file.is_open())
+        file.close();
+    index.clear();
+    keyframes.clear();
+    next_entry = 0;
+    time = 0.0f;
+}
+
+float GameReplay::getDuration()
+{
+    if (index.empty())
+        return 0.0f;
+    return index.back().time;
+}
+
+void GameReplay::seek(float target_time)
+{
+    if (keyframes.empty())
+        return;
+    target_time = std::clamp(target_time, 0.0f, getDuration());
+
+    // Find the last keyframe at or before the requested time, and apply everything from there on.
+    auto it = std::upper_bound(keyframes.begin(), keyframes.end(), target_time, [this](float t, size_t entry_index) { return t < index[entry_index].time; });
+    if (it != keyframes.begin())
+        --it;
+
+    clearEntities();
+    next_entry = *it;
+    while(next_entry < index.size() && (next_entry == *it || index[next_entry].time <= target_time))
+        applyEntry(next_entry++);
+    time = target_time;
+    clock.restart();
+}
+
+void GameReplay::setSpeed(float new_speed)
+{
+    speed = std::clamp(new_speed, 1.0f, max_speed);
+}
+
+void GameReplay::update(float delta)
+{
+    // The game is paused during a replay, so keep our own clock instead of using the game delta.
+    float real_delta = clock.restart();
+    if (paused || index.empty())
+        return;
+
+    real_delta *= speed;
+    time = std::min(time + real_delta, getDuration());
+    while(next_entry < index.size() && index[next_entry].time <= time)
+        applyEntry(next_entry++);
+    updateEffects(real_delta);
+}
+
+void GameReplay::applyEntry(size_t entry_index)
+{
+    file.seekg(index[entry_index].offset);
+    if (!std::getline(file, line))
+    {
+        file.clear();
+        return;
+    }
+    std::string err;
+    auto parsed = sp::json::parse(line, err);
+    if (!parsed)
+    {
+        LOG(WARNING) << "Failed to parse game state log entry " << entry_index << ": " << err;
+        return;
+    }
+    const auto& entry = parsed.value();
+
+    for(auto key : {"del_static", "del"})
+    {
+        if (!entry.contains(key))
+            continue;
+        for(const auto& id : entry[key])
+        {
+            auto it = entities.find(id.get<int>());
+            if (it == entities.end())
+                continue;
+            it->second.destroy();
+            entities.erase(it);
+        }
+    }
+    if (entry.contains("new_static"))
+        for(const auto& object : entry["new_static"])
+            applyObject(object, true);
+    if (entry.contains("objects"))
+        for(const auto& object : entry["objects"])
+            applyObject(object, false);
+
+    // A keyframe contains every object, so anything it does not mention is gone.
+    // Keep the others instead of recreating them, so effects and entity handles survive the keyframe.
+    if (index[entry_index].keyframe)
+    {
+        std::unordered_set<int> present;
+        for(auto key : {"new_static", "objects"})
+            if (entry.contains(key))
+                for(const auto& object : entry[key])
+                    present.insert(object["id"].get<int>());
+        for(auto it = entities.begin(); it != entities.end();)
+        {
+            if (present.find(it->first) == present.end())
+            {
+                it->second.destroy();
+                it = entities.erase(it);
+            }
+            else
+            {
+                ++it;
+            }
+        }
+    }
+
+    if (entry.contains("beams"))
+    {
+        for(const auto& beam : entry["beams"])
+        {
+            auto source = findEntity(beam["source"]);
+            auto source_transform = source.getComponent<sp::Transform>();
+            if (!source_transform)
+                continue;
+            auto e = sp::ecs::Entity::create();
+            e.addComponent<sp::Transform>(*source_transform);
+            auto& be = e.addComponent<BeamEffect>();
+            be.source = source;
+            be.target = findEntity(beam["target"]);
+            be.target_location = {beam["location"][0].get<float>(), beam["location"][1].get<float>()};
+            be.beam_texture = "texture/beam_orange.png";
+            effects.push_back(e);
+        }
+    }
+    if (entry.contains("explosions"))
+    {
+        for(const auto& explosion : entry["explosions"])
+        {
+            auto e = sp::ecs::Entity::create();
+            e.addComponent<sp::Transform>().setPosition({explosion["position"][0].get<float>(), explosion["position"][1].get<float>()});
+            auto& ee = e.addComponent<ExplosionEffect>();
+            ee.size = explosion["size"].get<float>();
+            ee.electrical = explosion["electrical"].get<bool>();
+            ee.radar = true;
+            effects.push_back(e);
+        }
+    }
+}
+
+void GameReplay::applyObject(const nlohmann::json& object, bool is_static)
+{
+    auto id = object["id"].get<int>();
+    auto& entity = entities[id];
+    if (!entity)
+        entity = sp::ecs::Entity::create();
+
+    auto& transform = entity.getOrAddComponent<sp::Transform>();
+    if (object.contains("position"))
+        transform.setPosition({object["position"][0].get<float>(), object["position"][1].get<float>()});
+    if (object.contains("rotation"))
+        transform.setRotation(object["rotation"].get<float>());
+
+    if (object.contains("callsign"))
+    {
+        auto callsign = object["callsign"].get<std::string>();
+        if (!callsign.empty())
+            entity.getOrAddComponent<CallSign>().callsign = callsign;
+        else
+            entity.removeComponent<CallSign>();
+    }
+    if (object.contains("type"))
+    {
+        auto type_name = object["type"].get<std::string>();
+        if (!type_name.empty())
+            entity.getOrAddComponent<TypeName>().type_name = type_name;
+        else
+            entity.removeComponent<TypeName>();
+    }
+    if (object.contains("faction"))
+    {
+        auto faction = object["faction"].get<std::string>();
+        if (!faction.empty())
+            entity.getOrAddComponent<Faction>().entity = getFaction(faction);
+        else
+            entity.removeComponent<Faction>();
+    }
+    if (object.contains("icon"))
+    {
+        auto icon = object["icon"].get<std::string>();
+        if (!icon.empty())
+        {
+            auto& trace = entity.getOrAddComponent<RadarTrace>();
+            trace.icon = icon;
+            if (!is_static)
+                trace.flags |= RadarTrace::ColorByFaction;
+        }
+        else
+        {
+            entity.removeComponent<RadarTrace>();
+        }
+    }
+
+    if (object.contains("hull"))
+    {
+        auto& hull = entity.getOrAddComponent<Hull>();
+        hull.current = object["hull"].get<float>();
+        hull.max = object["hull_max"].get<float>();
+    }
+    if (object.contains("shields"))
+    {
+        auto& shields = entity.getOrAddComponent<Shields>();
+        const auto& levels = object["shields"];
+        shields.entries.resize(levels.size());
+        for(size_t n=0; n<levels.size(); n++)
+        {
+            shields.entries[n].level = levels[n].get<float>();
+            shields.entries[n].max = std::max(shields.entries[n].max, shields.entries[n].level);
+        }
+    }
+}
+
+void GameReplay::updateEffects(float delta)
+{
+    // The systems that normally expire these effects do not run while the game is paused.
+    effects.erase(std::remove_if(effects.begin(), effects.end(), [delta](sp::ecs::Entity& e) {
+        float* lifetime = nullptr;
+        if (auto be = e.getComponent<BeamEffect>())
+            lifetime = &be->lifetime;
+        else if (auto ee = e.getComponent<ExplosionEffect>())
+            lifetime = &ee->lifetime;
+        if (!lifetime)
+            return true;
+        *lifetime -= delta;
+        if (*lifetime < 0.0f)
+        {
+            e.destroy();
+            return true;
+        }
+        return false;
+    }), effects.end());
+}
+
+void GameReplay::clearEntities()
+{
+    for(auto& [id, entity] : entities)
+        entity.destroy();
+    entities.clear();
+    for(auto& e : effects)
+        e.destroy();
+    effects.clear();
+    for(auto& e : factions)
+        e.destroy();
+    factions.clear();
+}
+
+sp::ecs::Entity GameReplay::findEntity(const nlohmann::json& id)
+{
+    auto it = entities.find(id.get<int>());
+    if (it == entities.end())
+        return {};
+    return it->second;
+}
+
+sp::ecs::Entity GameReplay::getFaction(const string& name)
+{
+    auto faction = Faction::find(name);
+    if (!faction)
+    {
+        faction = sp::ecs::Entity::create();
+        auto& info = faction.addComponent<FactionInfo>();
+        info.name = name;
+        info.locale_name = name;
+        factions.push_back(faction);
+    }
+    return faction;
+}
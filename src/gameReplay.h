@@ -0,0 +1,76 @@
+#ifndef GAME_REPLAY_H
+#define GAME_REPLAY_H
+
+#include "Updatable.h"
+#include "timer.h"
+#include "ecs/entity.h"
+#include "io/json.h"
+
+#include <fstream>
+#include <unordered_map>
+
+class GameReplay;
+extern P<GameReplay> game_replay;
+
+/*
+ * The GameReplay plays back a log written by the GameStateLogger.
+ * It creates entities and sets their components directly from the log, the simulation systems are not involved,
+ *  so the game should be paused while a replay is running.
+ *
+ * When the log is opened, an index of all entries is build. Seeking starts from the nearest keyframe entry before
+ *  the requested time, so only a few entries need to be read.
+ * Playback uses real time instead of game time, and can run at 1x to 64x speed.
+ */
+class GameReplay : public Updatable
+{
+public:
+    static constexpr float max_speed = 64.0f;
+
+    GameReplay();
+    virtual ~GameReplay();
+
+    bool open(const string& filename);
+    void close();
+
+    float getDuration();
+    float getTime() { return time; }
+    void seek(float time);
+
+    float getSpeed() { return speed; }
+    void setSpeed(float speed);
+    bool isPaused() { return paused; }
+    void setPaused(bool paused) { this->paused = paused; }
+
+    virtual void update(float delta) override;
+private:
+    struct IndexEntry
+    {
+        std::streamoff offset;
+        float time;
+        bool keyframe;
+    };
+
+    std::ifstream file;
+    std::vector<IndexEntry> index;
+    std::vector<size_t> keyframes;
+    size_t next_entry = 0;
+    float time = 0.0f;
+    float speed = 1.0f;
+    bool paused = false;
+    sp::SystemStopwatch clock;
+    std::string line;
+
+    std::unordered_map<int, sp::ecs::Entity> entities;
+    std::vector<sp::ecs::Entity> effects;
+    // Factions that are named in the log but do not exist in the running game.
+    std::vector<sp::ecs::Entity> factions;
+
+    void applyEntry(size_t entry_index);
+    void applyObject(const nlohmann::json& object, bool is_static);
+    void updateEffects(float delta);
+    void clearEntities();
+    sp::ecs::Entity findEntity(const nlohmann::json& id);
+    sp::ecs::Entity getFaction(const string& name);
+};
+
+#endif//GAME_REPLAY_H
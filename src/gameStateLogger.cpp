@@ -1,4 +1,5 @@
 #include <memory>
+#include <algorithm>
 #include <time.h>
 
 // SeriousProton provides nlohmann/json.
@@ -9,7 +10,18 @@
 
 #include "gameStateLogger.h"
 #include "gameGlobalInfo.h"
+#include "preferenceManager.h"
 #include "engine.h"
+#include "ecs/query.h"
+#include "components/collision.h"
+#include "components/hull.h"
+#include "components/shields.h"
+#include "components/name.h"
+#include "components/faction.h"
+#include "components/radar.h"
+#include "components/beamweapon.h"
+#include "components/rendering.h"
+#include "systems/damage.h"
 
 class JSONGenerator
 {
@@ -114,10 +126,26 @@ private:
     }
     void writeValue(const string& value)
     {
+        // Names can be set freely by scripts and the GM, so escape them. This can grow the string up to 6 times.
         const char* str = value.c_str();
         *ptr++ = '"';
-        while(*str)
-            *ptr++ = *str++;
+        for(; *str; str++)
+        {
+            auto c = static_cast<unsigned char>(*str);
+            if (c == '"' || c == '\\')
+            {
+                *ptr++ = '\\';
+                *ptr++ = c;
+            }
+            else if (c < 0x20)
+            {
+                ptr += sprintf(ptr, "\\u%04x", c);
+            }
+            else
+            {
+                *ptr++ = c;
+            }
+        }
         *ptr++ = '"';
     }
 
@@ -150,20 +178,47 @@ void GameStateLogger::start()
     else
         LOG(WARNING) << "Failed to open game state log file: " << filename_buffer;
     start_time = engine->getElapsedTime();
+
+    // Amount of state entries logged per second of game time.
+    float rate = std::clamp(PreferencesManager::get("game_logs_rate", "1").toFloat(), 0.1f, 60.0f);
+    logging_interval = 1.0f / rate;
+
+    if (log_file)
+    {
+        run_writer = true;
+        writer_thread = std::thread(&GameStateLogger::writerLoop, this);
+    }
 }
 
 void GameStateLogger::stop()
 {
+    if (writer_thread.joinable())
+    {
+        {
+            std::lock_guard<std::mutex> lock(queue_mutex);
+            run_writer = false;
+        }
+        queue_condition.notify_one();
+        writer_thread.join();
+    }
     if (log_file)
     {
         fclose(log_file);
         log_file = nullptr;
     }
+    last_state.clear();
+    static_objects.clear();
+    pending_damage.clear();
 }
 
 void GameStateLogger::update(float delta)
 {
-    if (!log_file || delta == 0.0f)
+    if (!log_file)
+        return;
+    DamageSystem::readEvents(damage_event_position, [this](const DamageEvent& event) {
+        pending_damage.push_back({event.entity.getIndex(), event.info.instigator ? int(event.info.instigator.getIndex()) : -1, int(event.info.type), event.shield_damage, event.hull_damage, event.destroyed});
+    });
+    if (delta == 0.0f)
         return;
 
     logging_delay -= delta;
@@ -181,9 +236,329 @@ void GameStateLogger::update(float delta)
         "time": game time passed since start of logging,
         "new_static": [ list of object entries that are not likely to change, and only send once ],
         "objects": [ list of updated objects, this can include objects that have been created by new_static before ],
-        "del_static": [ list of ids that have been added with "new_static" in a previous entry, but have been destroyed now ]
+        "del_static": [ list of ids that have been added with "new_static" in a previous entry, but have been destroyed now ],
+        "del": [ list of ids that have been added with "objects" in a previous entry, but have been destroyed now ],
+        "beams": [ list of beams fired since the previous entry, as {"source": id, "target": id, "location": [x, y]} ],
+        "explosions": [ list of explosions since the previous entry, as {"position": [x, y], "size": size, "electrical": bool} ],
+        "damage": [ list of damage done since the previous entry, as {"target": id, "source": id or -1, "type": "energy"/"kinetic"/"emp", "shield": amount, "hull": amount, "destroyed": bool} ]
     }
+   Object entries always contain the "id", all other fields are only written when they changed since the last entry
+   that contained this object. Deletions of an entry are applied before the new and updated objects, as ids can be reused.
+   A keyframe entry has the same layout with "type": "keyframe", and contains the full state of every object.
+   Everything known from previous entries can be discarded when a keyframe is read.
 */
 void GameStateLogger::logGameState()
 {
+    {
+        std::lock_guard<std::mutex> lock(queue_mutex);
+        if (queue.size() >= max_pending_entries)
+        {
+            // Skip this entry without touching last_state, so the next entry contains all changes since the last written one.
+            if (dropped_entries % 100 == 0)
+                LOG(WARNING) << "Game state log writer cannot keep up, skipping entries.";
+            dropped_entries++;
+            return;
+        }
+    }
+
+    Entry entry;
+    entry.time = engine->getElapsedTime() - start_time;
+    entry.keyframe = last_state.empty() || entries_since_keyframe >= max_entries_per_keyframe || entry.time - last_keyframe_time >= keyframe_interval;
+    if (entry.keyframe)
+    {
+        last_keyframe_time = entry.time;
+        entries_since_keyframe = 0;
+    }
+    entries_since_keyframe++;
+    tick_counter++;
+    entry.damage = std::move(pending_damage);
+    pending_damage.clear();
+
+    // Short lived effects are logged as events when they are created, instead of as objects.
+    for(auto [entity, beam] : sp::ecs::Query<BeamEffect>())
+    {
+        auto it = known_effects.find(entity.getIndex());
+        if (it != known_effects.end() && it->second == entity.getVersion())
+            continue;
+        known_effects[entity.getIndex()] = entity.getVersion();
+        entry.beams.push_back({beam.source.getIndex(), beam.target.getIndex(), beam.target_location});
+    }
+    for(auto [entity, explosion, transform] : sp::ecs::Query<ExplosionEffect, sp::Transform>())
+    {
+        auto it = known_effects.find(entity.getIndex());
+        if (it != known_effects.end() && it->second == entity.getVersion())
+            continue;
+        known_effects[entity.getIndex()] = entity.getVersion();
+        entry.explosions.push_back({transform.getPosition(), explosion.size, explosion.electrical});
+    }
+    for(auto it = known_effects.begin(); it != known_effects.end(); )
+    {
+        auto effect = sp::ecs::Entity::forced(it->first, it->second);
+        if (!effect.hasComponent<BeamEffect>() && !effect.hasComponent<ExplosionEffect>())
+            it = known_effects.erase(it);
+        else
+            ++it;
+    }
+
+    auto& current = current_state;
+    for(auto [entity, transform] : sp::ecs::Query<sp::Transform>())
+    {
+        if (entity.hasComponent<BeamEffect>() || entity.hasComponent<ExplosionEffect>())
+            continue;
+
+        auto hull = entity.getComponent<Hull>();
+        auto physics = entity.getComponent<sp::Physics>();
+        current.index = entity.getIndex();
+        current.version = entity.getVersion();
+        current.is_static = !hull && (!physics || physics->getType() == sp::Physics::Type::Static);
+        current.position = transform.getPosition();
+        current.rotation = transform.getRotation();
+        current.has_hull = hull != nullptr;
+        current.hull = hull ? hull->current : 0.0f;
+        current.hull_max = hull ? hull->max : 0.0f;
+        current.shields.clear();
+        if (auto shields = entity.getComponent<Shields>())
+            for(auto& shield : shields->entries)
+                current.shields.push_back(shield.level);
+        auto callsign = entity.getComponent<CallSign>();
+        current.callsign = callsign ? callsign->callsign : "";
+        auto type_name = entity.getComponent<TypeName>();
+        current.type_name = type_name ? type_name->type_name : "";
+        auto faction = entity.getComponent<Faction>();
+        auto faction_info = faction ? faction->entity.getComponent<FactionInfo>() : nullptr;
+        current.faction = faction_info ? faction_info->name : "";
+        auto radar_trace = entity.getComponent<RadarTrace>();
+        current.icon = radar_trace ? radar_trace->icon : "";
+
+        auto it = last_state.find(current.index);
+        if (it != last_state.end() && it->second.version != current.version)
+        {
+            // The index got reused by a new entity, so the old one is gone.
+            if (it->second.is_static)
+            {
+                entry.del_static.push_back(current.index);
+                static_objects.erase(current.index);
+            }
+            else
+            {
+                entry.deleted.push_back(current.index);
+            }
+            last_state.erase(it);
+            it = last_state.end();
+        }
+
+        if (it == last_state.end())
+        {
+            current.changed = EntityState::All;
+            current.last_seen = tick_counter;
+            if (current.is_static)
+            {
+                entry.new_static.push_back(current);
+                static_objects[current.index] = current.position;
+            }
+            else
+            {
+                entry.objects.push_back(current);
+            }
+            last_state.emplace(current.index, current);
+            continue;
+        }
+
+        auto& last = it->second;
+        last.last_seen = tick_counter;
+        if (entry.keyframe)
+        {
+            current.changed = EntityState::All;
+            current.last_seen = tick_counter;
+            current.is_static = last.is_static;
+            last = current;
+            if (current.is_static)
+                entry.new_static.push_back(current);
+            else
+                entry.objects.push_back(current);
+            continue;
+        }
+        if (last.is_static)
+            continue;
+
+        uint32_t changed = 0;
+        if (last.position != current.position)
+            changed |= EntityState::Position;
+        if (last.rotation != current.rotation)
+            changed |= EntityState::Rotation;
+        if (last.hull != current.hull || last.hull_max != current.hull_max)
+            changed |= EntityState::HullLevel;
+        if (last.shields != current.shields)
+            changed |= EntityState::ShieldLevels;
+        if (last.callsign != current.callsign || last.type_name != current.type_name || last.faction != current.faction || last.icon != current.icon)
+            changed |= EntityState::Names;
+        if (!changed)
+            continue;
+
+        current.changed = changed;
+        current.last_seen = tick_counter;
+        last = current;
+        entry.objects.push_back(current);
+    }
+
+    for(auto it = last_state.begin(); it != last_state.end(); )
+    {
+        if (it->second.last_seen != tick_counter)
+        {
+            if (it->second.is_static)
+            {
+                entry.del_static.push_back(it->first);
+                static_objects.erase(it->first);
+            }
+            else
+            {
+                entry.deleted.push_back(it->first);
+            }
+            it = last_state.erase(it);
+        }
+        else
+        {
+            ++it;
+        }
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(queue_mutex);
+        queue.push_back(std::move(entry));
+    }
+    queue_condition.notify_one();
+}
+
+void GameStateLogger::writerLoop()
+{
+    std::vector<char> buffer;
+    std::unique_lock<std::mutex> lock(queue_mutex);
+    while(true)
+    {
+        queue_condition.wait(lock, [this]() { return !queue.empty() || !run_writer; });
+        if (queue.empty())
+            break;
+        Entry entry = std::move(queue.front());
+        queue.pop_front();
+        lock.unlock();
+        writeEntry(entry, buffer);
+        lock.lock();
+    }
+    fflush(log_file);
+}
+
+void GameStateLogger::writeEntry(const Entry& entry, std::vector<char>& buffer)
+{
+    // The JSONGenerator does not do bounds checking, so reserve a worst case size for every entry.
+    size_t size = 256 + 16 * (entry.del_static.size() + entry.deleted.size()) + 128 * (entry.beams.size() + entry.explosions.size() + entry.damage.size());
+    for(auto list : {&entry.new_static, &entry.objects})
+        for(auto& state : *list)
+            size += 256 + 6 * (state.callsign.size() + state.type_name.size() + state.faction.size() + state.icon.size()) + 32 * state.shields.size();
+    if (buffer.size() < size)
+        buffer.resize(size);
+
+    char* ptr = buffer.data();
+    {
+        JSONGenerator json(ptr);
+        json.write("type", entry.keyframe ? "keyframe" : "state");
+        json.write("time", entry.time);
+        json.startArray("new_static");
+        for(auto& state : entry.new_static)
+        {
+            JSONGenerator object = json.arrayCreateDict();
+            writeEntityState(object, state);
+        }
+        json.endArray();
+        json.startArray("objects");
+        for(auto& state : entry.objects)
+        {
+            JSONGenerator object = json.arrayCreateDict();
+            writeEntityState(object, state);
+        }
+        json.endArray();
+        json.startArray("del_static");
+        for(auto index : entry.del_static)
+            json.arrayWrite(int(index));
+        json.endArray();
+        json.startArray("del");
+        for(auto index : entry.deleted)
+            json.arrayWrite(int(index));
+        json.endArray();
+        json.startArray("beams");
+        for(auto& beam : entry.beams)
+        {
+            JSONGenerator object = json.arrayCreateDict();
+            object.write("source", int(beam.source));
+            object.write("target", int(beam.target));
+            object.startArray("location");
+            object.arrayWrite(beam.target_location.x);
+            object.arrayWrite(beam.target_location.y);
+            object.endArray();
+        }
+        json.endArray();
+        json.startArray("explosions");
+        for(auto& explosion : entry.explosions)
+        {
+            JSONGenerator object = json.arrayCreateDict();
+            object.startArray("position");
+            object.arrayWrite(explosion.position.x);
+            object.arrayWrite(explosion.position.y);
+            object.endArray();
+            object.write("size", explosion.size);
+            object.write("electrical", explosion.electrical);
+        }
+        json.endArray();
+        json.startArray("damage");
+        for(auto& damage : entry.damage)
+        {
+            JSONGenerator object = json.arrayCreateDict();
+            object.write("target", int(damage.target));
+            object.write("source", damage.source);
+            switch(DamageType(damage.type))
+            {
+            case DamageType::Energy: object.write("type", "energy"); break;
+            case DamageType::Kinetic: object.write("type", "kinetic"); break;
+            case DamageType::EMP: object.write("type", "emp"); break;
+            }
+            object.write("shield", damage.shield);
+            object.write("hull", damage.hull);
+            object.write("destroyed", damage.destroyed);
+        }
+        json.endArray();
+    }
+    *ptr++ = '\n';
+    fwrite(buffer.data(), 1, ptr - buffer.data(), log_file);
+}
+
+void GameStateLogger::writeEntityState(JSONGenerator& json, const EntityState& state)
+{
+    json.write("id", int(state.index));
+    if (state.changed & EntityState::Names)
+    {
+        json.write("type", state.type_name);
+        json.write("callsign", state.callsign);
+        json.write("faction", state.faction);
+        json.write("icon", state.icon);
+    }
+    if (state.changed & EntityState::Position)
+    {
+        json.startArray("position");
+        json.arrayWrite(state.position.x);
+        json.arrayWrite(state.position.y);
+        json.endArray();
+    }
+    if (state.changed & EntityState::Rotation)
+        json.write("rotation", state.rotation);
+    if ((state.changed & EntityState::HullLevel) && state.has_hull)
+    {
+        json.write("hull", state.hull);
+        json.write("hull_max", state.hull_max);
+    }
+    if ((state.changed & EntityState::ShieldLevels) && !state.shields.empty())
+    {
+        json.startArray("shields");
+        for(auto level : state.shields)
+            json.arrayWrite(level);
+        json.endArray();
+    }
 }
@@ -2,6 +2,13 @@
 #define GAME_STATE_LOGGER_H
 
 #include "Updatable.h"
+#include "ecs/entity.h"
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <unordered_map>
 
 class JSONGenerator;
 /*
@@ -12,6 +19,12 @@ class JSONGenerator;
  * The resulting log contains 2 types of records:
  * 1) Periodic game data, update of all the objects in the game with all states.
  * 2) Events fired by certain actions. Missile firing, beams firing, damage, destruction of certain objects.
+ *
+ * Only objects that changed since the previous entry are logged, and only the fields that changed.
+ * Every few seconds a keyframe entry is written that contains the full state, so a replay can seek without
+ *  reading the whole log from the start.
+ * Collecting the changes happens on the main thread, formatting and writing the log happens on a
+ *  separate writer thread. If the writer cannot keep up, entries are dropped instead of stalling the game.
  */
 class GameStateLogger : public Updatable
 {
@@ -25,13 +38,95 @@ public:
     virtual void update(float delta) override;
 
 private:
+    struct EntityState
+    {
+        static constexpr uint32_t Position = 1 << 0;
+        static constexpr uint32_t Rotation = 1 << 1;
+        static constexpr uint32_t HullLevel = 1 << 2;
+        static constexpr uint32_t ShieldLevels = 1 << 3;
+        static constexpr uint32_t Names = 1 << 4;
+        static constexpr uint32_t All = Position | Rotation | HullLevel | ShieldLevels | Names;
+
+        uint32_t index = 0;
+        uint32_t version = 0;
+        uint32_t changed = All;
+        uint32_t last_seen = 0;
+        bool is_static = false;
+
+        glm::vec2 position{};
+        float rotation = 0.0f;
+        bool has_hull = false;
+        float hull = 0.0f;
+        float hull_max = 0.0f;
+        std::vector<float> shields;
+        string callsign;
+        string type_name;
+        string faction;
+        string icon;
+    };
+    struct BeamEvent
+    {
+        uint32_t source;
+        uint32_t target;
+        glm::vec2 target_location;
+    };
+    struct ExplosionEvent
+    {
+        glm::vec2 position;
+        float size;
+        bool electrical;
+    };
+    struct Damage
+    {
+        uint32_t target;
+        int source;
+        int type;
+        float shield;
+        float hull;
+        bool destroyed;
+    };
+    struct Entry
+    {
+        float time = 0.0f;
+        bool keyframe = false;
+        std::vector<EntityState> new_static;
+        std::vector<EntityState> objects;
+        std::vector<uint32_t> del_static;
+        std::vector<uint32_t> deleted;
+        std::vector<BeamEvent> beams;
+        std::vector<ExplosionEvent> explosions;
+        std::vector<Damage> damage;
+    };
+    static constexpr size_t max_pending_entries = 32;
+    static constexpr float keyframe_interval = 10.0f;
+    static constexpr int max_entries_per_keyframe = 100;
+
     FILE* log_file;
     float logging_interval;
     float logging_delay;
     float start_time;
     std::map<int, glm::vec2> static_objects;
+    std::unordered_map<uint32_t, EntityState> last_state;
+    EntityState current_state;
+    uint32_t tick_counter = 0;
+    int dropped_entries = 0;
+    float last_keyframe_time = 0.0f;
+    int entries_since_keyframe = 0;
+    std::unordered_map<uint32_t, uint32_t> known_effects;
+    // Damage events are read every frame, as the damage system only keeps them for a short while.
+    uint64_t damage_event_position = 0;
+    std::vector<Damage> pending_damage;
+
+    std::thread writer_thread;
+    std::mutex queue_mutex;
+    std::condition_variable queue_condition;
+    std::deque<Entry> queue;
+    bool run_writer = false;
 
     void logGameState();
+    void writerLoop();
+    void writeEntry(const Entry& entry, std::vector<char>& buffer);
+    static void writeEntityState(JSONGenerator& json, const EntityState& state);
 };
 
 #endif//GAME_STATE_LOGGER_H
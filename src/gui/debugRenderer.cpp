@@ -1,6 +1,7 @@
 #include "debugRenderer.h"
 #include "multiplayer_server.h"
 #include "hotkeyConfig.h"
+#include "profiler.h"
 
 static glm::u8vec4 line_colors[] = {
     {255, 0, 0, 255},
@@ -38,6 +39,17 @@ void DebugRenderer::render(sp::RenderTarget& renderer)
     {
         show_timing_graph = !show_timing_graph;
         timing_graph_points.clear();
+        // Keep profiling when it was turned on from the preferences or the HTTP server.
+        if (show_timing_graph && !Profiler::isEnabled())
+        {
+            Profiler::setEnabled(true);
+            profiler_enabled_here = true;
+        }
+        else if (!show_timing_graph && profiler_enabled_here)
+        {
+            Profiler::setEnabled(false);
+            profiler_enabled_here = false;
+        }
     }
 
     fps_counter++;
@@ -109,6 +121,17 @@ void DebugRenderer::render(sp::RenderTarget& renderer)
                 sp::Alignment::BottomLeft, 16, nullptr, line_colors[index % 6]);
             index += 1;
         }
+
+        // Slowest profiler sections, average and maximum over the last few seconds.
+        string profile_text = "";
+        int line_count = 0;
+        for(auto& stats : Profiler::getStats())
+        {
+            if (line_count++ >= max_profiler_lines)
+                break;
+            profile_text += stats.name + ": " + string(stats.average, 2) + " / " + string(stats.max, 2) + "ms\n";
+        }
+        renderer.drawText(sp::Rect(window_size.x, 0, 0, 0), profile_text, sp::Alignment::TopRight, 16);
     }
     renderer.drawText(sp::Rect(0, 0, 0, 0), text, sp::Alignment::TopLeft, 18);
 }
@@ -16,6 +16,9 @@ private:
     bool show_fps;
     bool show_datarate;
     bool show_timing_graph;
+    // The profiler was enabled by showing the timing graph, so it is disabled again when the graph is hidden.
+    bool profiler_enabled_here = false;
+    static constexpr int max_profiler_lines = 20;
 
     std::map<string, std::vector<float>> timing_graph_points;
 public:
@@ -1,6 +1,8 @@
 #include "httpScriptAccess.h"
 #include "gameGlobalInfo.h"
 #include "script.h"
+#include "profiler.h"
+#include "scriptProfiler.h"
 
 #define sOBJECT "_OBJECT_"
 
@@ -25,6 +27,22 @@ EEHttpServer::EEHttpServer(int port, string static_file_path)
         }
         return output;
     });
+    server.addURLHandler("/profiler.json", [](const sp::io::http::Server::Request& request) -> string
+    {
+        // The first request turns the profiler on, so it starts collecting from then on.
+        Profiler::setEnabled(true);
+        return Profiler::getStatsJSON();
+    });
+    server.addURLHandler("/profiler_trace.json", [](const sp::io::http::Server::Request& request) -> string
+    {
+        // Save the result and load it in chrome://tracing or https://ui.perfetto.dev
+        Profiler::setEnabled(true);
+        return Profiler::getChromeTraceJSON();
+    });
+    server.addURLHandler("/script_profiler.json", [](const sp::io::http::Server::Request& request) -> string
+    {
+        return ScriptProfiler::getStatsJSON();
+    });
     server.addURLHandler("/get.lua", [](const sp::io::http::Server::Request& request) -> string
     {
         /*
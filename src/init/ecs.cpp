@@ -39,6 +39,7 @@
 #include "multiplayer/zone.h"
 
 #include "systems/ai.h"
+#include "systems/faction.h"
 #include "systems/docking.h"
 #include "systems/comms.h"
 #include "systems/impulse.h"
@@ -61,10 +62,15 @@
 #include "systems/scanning.h"
 #include "systems/radar.h"
 #include "systems/radarblock.h"
+#include "systems/radarvisibility.h"
 #include "systems/zone.h"
 #include "systems/gm.h"
 #include "systems/pickup.h"
 #include "systems/debugrender.h"
+#include "profiler.h"
+
+// Systems are wrapped so the time spend in their update shows up in the profiler.
+#define REGISTER_SYSTEM(T) do { ProfiledSystem<T>::profile_name = #T; engine->registerSystem<ProfiledSystem<T>>(); } while(0)
 
 
 void initSystemsAndComponents()
@@ -127,39 +133,41 @@ void initSystemsAndComponents()
     sp::ecs::MultiplayerReplication::registerComponentReplication<sp::multiplayer::TransformReplication>();
     sp::ecs::MultiplayerReplication::registerComponentReplication<sp::multiplayer::PhysicsReplication>();
 
-    engine->registerSystem<AISystem>();
-    engine->registerSystem<DamageSystem>();
-    engine->registerSystem<EnergySystem>();
-    engine->registerSystem<DockingSystem>();
-    engine->registerSystem<CommsSystem>();
-    engine->registerSystem<JumpSystem>(); // must be before impulse/warp
-    engine->registerSystem<ImpulseSystem>();
-    engine->registerSystem<ManeuveringSystem>();
-    engine->registerSystem<WarpSystem>();
-    engine->registerSystem<BeamWeaponSystem>();
-    engine->registerSystem<MissileSystem>();
-    engine->registerSystem<ShieldSystem>();
-    engine->registerSystem<CoolantSystem>();
-    engine->registerSystem<ShipSystemsSystem>();
-    engine->registerSystem<SelfDestructSystem>();
-    engine->registerSystem<BasicMovementSystem>();
-    engine->registerSystem<GravitySystem>();
-    engine->registerSystem<InternalCrewSystem>();
-    engine->registerSystem<PathFindingSystem>();
-    engine->registerSystem<NebulaRenderSystem>();
-    engine->registerSystem<ExplosionRenderSystem>();
-    engine->registerSystem<BillboardRenderSystem>();
-    engine->registerSystem<PlanetRenderSystem>();
-    engine->registerSystem<PlanetTransparentRenderSystem>();
-    engine->registerSystem<MeshRenderSystem>();
-    engine->registerSystem<ScanningSystem>();
-    engine->registerSystem<BasicRadarRendering>();
-    engine->registerSystem<RadarBlockSystem>();
-    engine->registerSystem<ZoneSystem>();
-    engine->registerSystem<GMRadarRender>();
-    engine->registerSystem<PickupSystem>();
+    REGISTER_SYSTEM(FactionSystem);
+    REGISTER_SYSTEM(AISystem);
+    REGISTER_SYSTEM(EnergySystem);
+    REGISTER_SYSTEM(DockingSystem);
+    REGISTER_SYSTEM(CommsSystem);
+    REGISTER_SYSTEM(JumpSystem); // must be before impulse/warp
+    REGISTER_SYSTEM(ImpulseSystem);
+    REGISTER_SYSTEM(ManeuveringSystem);
+    REGISTER_SYSTEM(WarpSystem);
+    REGISTER_SYSTEM(BeamWeaponSystem);
+    REGISTER_SYSTEM(MissileSystem);
+    REGISTER_SYSTEM(ShieldSystem);
+    REGISTER_SYSTEM(CoolantSystem);
+    REGISTER_SYSTEM(ShipSystemsSystem);
+    REGISTER_SYSTEM(SelfDestructSystem);
+    REGISTER_SYSTEM(BasicMovementSystem);
+    REGISTER_SYSTEM(GravitySystem);
+    REGISTER_SYSTEM(DamageSystem); // must be after all systems that queue damage from their update. Damage queued from collision handlers, like missile hits, can resolve a frame later.
+    REGISTER_SYSTEM(InternalCrewSystem);
+    REGISTER_SYSTEM(PathFindingSystem);
+    REGISTER_SYSTEM(NebulaRenderSystem);
+    REGISTER_SYSTEM(ExplosionRenderSystem);
+    REGISTER_SYSTEM(BillboardRenderSystem);
+    REGISTER_SYSTEM(PlanetRenderSystem);
+    REGISTER_SYSTEM(PlanetTransparentRenderSystem);
+    REGISTER_SYSTEM(MeshRenderSystem);
+    REGISTER_SYSTEM(ScanningSystem);
+    REGISTER_SYSTEM(BasicRadarRendering);
+    REGISTER_SYSTEM(RadarBlockSystem);
+    REGISTER_SYSTEM(RadarVisibilitySystem);
+    REGISTER_SYSTEM(ZoneSystem);
+    REGISTER_SYSTEM(GMRadarRender);
+    REGISTER_SYSTEM(PickupSystem);
 #ifdef DEBUG
-    engine->registerSystem<DebugRenderSystem>();
+    REGISTER_SYSTEM(DebugRenderSystem);
 #endif
     initComponentScriptBindings();
 }
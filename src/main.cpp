@@ -24,6 +24,8 @@
 #include "preferenceManager.h"
 #include "networkRecorder.h"
 #include "tutorialGame.h"
+#include "gameReplay.h"
+#include "screens/spectatorScreen.h"
 #include "windowManager.h"
 #include "init/config.h"
 #include "init/resources.h"
@@ -44,6 +46,9 @@
 
 #include "shaderRegistry.h"
 #include "glObjects.h"
+#include "mesh.h"
+#include "profiler.h"
+#include "script.h"
 
 glm::vec3 camera_position;
 float camera_yaw;
@@ -119,6 +124,9 @@ int main(int argc, char** argv)
     keys.init();
     colorConfig.load();
 
+    if (PreferencesManager::get("profiler").toInt())
+        Profiler::setEnabled(true);
+
     if (PreferencesManager::get("httpserver").toInt() != 0)
     {
         int port_nr = PreferencesManager::get("httpserver").toInt();
@@ -146,8 +154,12 @@ int main(int argc, char** argv)
         GuiTheme::setCurrentTheme(theme_name);
     }
 
+    if (PreferencesManager::get("script_cache", "1").toInt())
+        setScriptCachePath(configuration_path + "/cache");
     if (PreferencesManager::get("headless") == "")
     {
+        if (PreferencesManager::get("mesh_cache", "1").toInt())
+            Mesh::setCachePath(configuration_path + "/cache");
         if (!createDisplayWindows())
             return 1;
     } else {
@@ -308,6 +320,22 @@ void returnToMainMenu(RenderLayer* render_layer)
         if (PreferencesManager::get("startpaused") != "1")
             engine->setGameSpeed(1.0);
     }
+    else if (!PreferencesManager::get("replay").empty())
+    {
+        // Review a recorded game state log. The server stays paused, the replay sets the entity states directly.
+        new EpsilonServer(defaultServerPort);
+        P<GameReplay> replay = new GameReplay();
+        if (replay->open(PreferencesManager::get("replay")))
+        {
+            new SpectatorScreen(render_layer);
+        }
+        else
+        {
+            replay->destroy();
+            game_server->destroy();
+            new MainMenu();
+        }
+    }
     else if (!PreferencesManager::get("autoconnect").empty())
     {
         auto value = PreferencesManager::get("autoconnect");
@@ -1,5 +1,16 @@
 #include <graphics/opengl.h>
 #include <unordered_map>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#ifndef ANDROID
+#include <filesystem>
+#endif
 #include <SDL_endian.h>
 #include <meshoptimizer.h>
 #include <glm/gtx/norm.hpp>
@@ -8,6 +19,9 @@
 #include "random.h"
 #include "mesh.h"
 
+// Defined before the loader threads are, so it is destroyed after they are joined.
+string Mesh::cache_path;
+
 namespace
 {
     inline int32_t readInt(const P<ResourceStream>& stream)
@@ -18,16 +32,82 @@ namespace
     }
 
     constexpr uint32_t NO_BUFFER = 0;
+    // Only used from the main thread.
     std::unordered_map<string, Mesh*> meshMap;
+
+    // Meshes requested with getMeshAsync are queued here, build by the loader threads, and then wait in
+    //  the loaded list until the main thread uploads them.
+    std::mutex loader_mutex;
+    std::condition_variable loader_work;
+    std::condition_variable loader_done;
+    std::deque<std::pair<Mesh*, string>> load_queue;
+    std::deque<std::pair<Mesh*, bool>> loaded;
+    std::vector<std::thread> loader_threads;
+    bool stop_loaders = false;
+
+    struct LoaderShutdown
+    {
+        ~LoaderShutdown()
+        {
+            {
+                std::lock_guard<std::mutex> lock(loader_mutex);
+                stop_loaders = true;
+            }
+            loader_work.notify_all();
+            for(auto& thread : loader_threads)
+                thread.join();
+        }
+    } loader_shutdown;
+
+    // Increase this when the layout of the cache files or the way meshes are build changes.
+    constexpr uint32_t cache_version = 1;
+    struct CacheHeader
+    {
+        char magic[4];
+        uint32_t version;
+        uint32_t vertex_size;
+        uint32_t face_count;
+        uint64_t source_hash;
+        uint64_t source_size;
+        uint32_t vertex_count;
+        uint32_t index_count;
+        float greatest_distance_from_center;
+        uint32_t padding;
+    };
+
+    // FNV-1a, 64 bit.
+    uint64_t hashData(const void* data, size_t size, uint64_t hash = 14695981039346656037ull)
+    {
+        auto ptr = static_cast<const uint8_t*>(data);
+        for(size_t n=0; n<size; n++)
+        {
+            hash ^= ptr[n];
+            hash *= 1099511628211ull;
+        }
+        return hash;
+    }
+
+    uint64_t hashStream(const P<ResourceStream>& stream)
+    {
+        uint64_t hash = 14695981039346656037ull;
+        char buffer[16 * 1024];
+        while(auto size = stream->read(buffer, sizeof(buffer)))
+            hash = hashData(buffer, size, hash);
+        return hash;
+    }
 }
 
 Mesh::Mesh(std::vector<MeshVertex>&& unindexed_vertices)
-    :face_count{ static_cast<uint32_t>(unindexed_vertices.size()) / 3}
 {
+    build(std::move(unindexed_vertices));
+    upload();
+}
+
+void Mesh::build(std::vector<MeshVertex>&& unindexed_vertices)
+{
+    face_count = static_cast<uint32_t>(unindexed_vertices.size()) / 3;
     if (!unindexed_vertices.empty())
     {
-        vbo_ibo = gl::Buffers<2>{};
-
         auto index_count = 3 * face_count;
         std::vector<uint32_t> remap_indices;
         {
@@ -53,6 +133,17 @@ Mesh::Mesh(std::vector<MeshVertex>&& unindexed_vertices)
             }
         }
 
+        greatest_distance_from_center = greatestDistanceFromCenter(vertices);
+    }
+}
+
+void Mesh::upload()
+{
+    ready = true;
+    if (!vertices.empty())
+    {
+        vbo_ibo = gl::Buffers<2>{};
+
         glBindBuffer(GL_ARRAY_BUFFER, vbo_ibo[0]);
         glBufferData(GL_ARRAY_BUFFER, sizeof(MeshVertex) * vertices.size(), vertices.data(), GL_STATIC_DRAW);
         glBindBuffer(GL_ARRAY_BUFFER, GL_NONE);
@@ -60,18 +151,24 @@ Mesh::Mesh(std::vector<MeshVertex>&& unindexed_vertices)
         if (!indices.empty())
         {
             glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, vbo_ibo[1]);
-            glBufferData(GL_ELEMENT_ARRAY_BUFFER, index_count * sizeof(uint16_t), indices.data(), GL_STATIC_DRAW);
+            glBufferData(GL_ELEMENT_ARRAY_BUFFER, face_count * 3 * sizeof(uint16_t), indices.data(), GL_STATIC_DRAW);
             glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, GL_NONE);
         }
-
-        greatest_distance_from_center = greatestDistanceFromCenter(vertices);
     }
 }
 
 void Mesh::render(int32_t position_attrib, int32_t texcoords_attrib, int32_t normal_attrib)
 {
-    if (vertices.empty() || vbo_ibo[0] == NO_BUFFER || (!indices.empty() && vbo_ibo[1] == NO_BUFFER))
+    if (!bind(position_attrib, texcoords_attrib, normal_attrib))
         return;
+    draw();
+    unbind();
+}
+
+bool Mesh::bind(int32_t position_attrib, int32_t texcoords_attrib, int32_t normal_attrib)
+{
+    if (!ready || vertices.empty() || vbo_ibo[0] == NO_BUFFER || (!indices.empty() && vbo_ibo[1] == NO_BUFFER))
+        return false;
 
     glBindBuffer(GL_ARRAY_BUFFER, vbo_ibo[0]);
 
@@ -84,25 +181,28 @@ void Mesh::render(int32_t position_attrib, int32_t texcoords_attrib, int32_t nor
     if (texcoords_attrib != -1)
         glVertexAttribPointer(texcoords_attrib, 2, GL_FLOAT, GL_FALSE, sizeof(MeshVertex), (void*)offsetof(MeshVertex, uv));
 
-
     if (!indices.empty())
-    {
         glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, vbo_ibo[1]);
-        glDrawElements(GL_TRIANGLES, face_count * 3, GL_UNSIGNED_SHORT, nullptr);
-        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, GL_NONE);
-    }
+    return true;
+}
 
+void Mesh::draw()
+{
+    if (!indices.empty())
+        glDrawElements(GL_TRIANGLES, face_count * 3, GL_UNSIGNED_SHORT, nullptr);
     else
-    {
         glDrawArrays(GL_TRIANGLES, 0, static_cast<GLsizei>(vertices.size()));
-    }
+}
 
+void Mesh::unbind()
+{
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, GL_NONE);
     glBindBuffer(GL_ARRAY_BUFFER, GL_NONE);
 }
 
 glm::vec3 Mesh::randomPoint()
 {
-    if (vertices.empty())
+    if (!ready || vertices.empty())
         return glm::vec3{};
 
     // Pick a face
@@ -168,14 +268,227 @@ struct IndexInfo
 
 Mesh* Mesh::getMesh(const string& filename)
 {
-    Mesh* ret = meshMap[filename];
-    if (ret)
-        return ret;
+    auto it = meshMap.find(filename);
+    if (it != meshMap.end())
+    {
+        auto mesh = it->second;
+        if (!mesh->ready && !mesh->failed)
+        {
+            std::unique_lock<std::mutex> lock(loader_mutex);
+            auto queued = std::find_if(load_queue.begin(), load_queue.end(), [mesh](auto& job) { return job.first == mesh; });
+            if (queued != load_queue.end())
+            {
+                // Not picked up by a loader thread yet, so load it here instead of waiting.
+                load_queue.erase(queued);
+                lock.unlock();
+                mesh->failed = !mesh->load(filename);
+            }
+            else
+            {
+                std::deque<std::pair<Mesh*, bool>>::iterator done;
+                loader_done.wait(lock, [mesh, &done]() {
+                    done = std::find_if(loaded.begin(), loaded.end(), [mesh](auto& job) { return job.first == mesh; });
+                    return done != loaded.end();
+                });
+                mesh->failed = !done->second;
+                loaded.erase(done);
+            }
+            if (!mesh->failed)
+                mesh->upload();
+        }
+        return mesh->failed ? nullptr : mesh;
+    }
 
+    auto mesh = new Mesh();
+    meshMap[filename] = mesh;
+    mesh->failed = !mesh->load(filename);
+    if (mesh->failed)
+        return nullptr;
+    mesh->upload();
+    return mesh;
+}
+
+Mesh* Mesh::getMeshAsync(const string& filename)
+{
+    auto it = meshMap.find(filename);
+    if (it != meshMap.end())
+        return it->second->failed ? nullptr : it->second;
+
+    auto mesh = new Mesh();
+    meshMap[filename] = mesh;
+    {
+        std::lock_guard<std::mutex> lock(loader_mutex);
+        if (loader_threads.empty())
+        {
+            // Parsing is mostly limited by the CPU, but leave some cores for the game itself.
+            unsigned int thread_count = std::clamp(std::thread::hardware_concurrency() / 2, 1u, 4u);
+            for(unsigned int n=0; n<thread_count; n++)
+                loader_threads.emplace_back(&Mesh::loaderThread);
+        }
+        load_queue.emplace_back(mesh, filename);
+    }
+    loader_work.notify_one();
+    return mesh;
+}
+
+void Mesh::uploadLoaded(float time_budget)
+{
+    auto start = std::chrono::steady_clock::now();
+    auto budget = std::chrono::duration<float>(time_budget);
+    // Always upload at least one mesh, so loading finishes even when the frame is already over budget.
+    do
+    {
+        std::pair<Mesh*, bool> job;
+        {
+            std::lock_guard<std::mutex> lock(loader_mutex);
+            if (loaded.empty())
+                return;
+            job = loaded.front();
+            loaded.pop_front();
+        }
+        job.first->failed = !job.second;
+        if (!job.first->failed)
+            job.first->upload();
+    } while(std::chrono::steady_clock::now() - start < budget);
+}
+
+void Mesh::loaderThread()
+{
+    std::unique_lock<std::mutex> lock(loader_mutex);
+    while(true)
+    {
+        loader_work.wait(lock, []() { return stop_loaders || !load_queue.empty(); });
+        if (stop_loaders)
+            return;
+        auto job = std::move(load_queue.front());
+        load_queue.pop_front();
+        lock.unlock();
+
+        bool ok = job.first->load(job.second);
+
+        lock.lock();
+        loaded.emplace_back(job.first, ok);
+        loader_done.notify_all();
+    }
+}
+
+void Mesh::setCachePath(const string& path)
+{
+#ifndef ANDROID
+    std::error_code error_code;
+    std::filesystem::create_directories(path.c_str(), error_code);
+    if (error_code)
+    {
+        LOG(WARNING) << "Failed to create mesh cache directory " << path << ": " << error_code.message();
+        return;
+    }
+    cache_path = path;
+#endif
+}
+
+bool Mesh::load(const string& filename)
+{
     P<ResourceStream> stream = getResourceStream(filename);
     if (!stream)
-        return NULL;
+        return false;
 
+    string cache_file;
+    uint64_t source_hash = 0;
+    uint64_t source_size = stream->getSize();
+    if (!cache_path.empty())
+    {
+        char name[32];
+        auto name_hash = hashData(filename.data(), filename.size());
+        snprintf(name, sizeof(name), "%016llx.mesh", static_cast<unsigned long long>(name_hash));
+        cache_file = cache_path + "/" + name;
+        source_hash = hashStream(stream);
+        if (loadCache(cache_file, source_hash, source_size))
+            return true;
+        stream->seek(0);
+    }
+
+    auto vertices = loadVertices(filename, stream);
+    if (vertices.empty())
+        return false;
+    build(std::move(vertices));
+    if (!cache_file.empty())
+        saveCache(cache_file, source_hash, source_size);
+    return true;
+}
+
+bool Mesh::loadCache(const string& cache_file, uint64_t source_hash, uint64_t source_size)
+{
+    FILE* f = fopen(cache_file.c_str(), "rb");
+    if (!f)
+        return false;
+    long file_size = -1;
+    if (fseek(f, 0, SEEK_END) == 0)
+        file_size = ftell(f);
+    CacheHeader header;
+    bool ok = fseek(f, 0, SEEK_SET) == 0 && fread(&header, sizeof(header), 1, f) == 1;
+    // Check the counts against the file size before allocating anything, a damaged header could ask for gigabytes.
+    ok = ok && file_size >= 0 && uint64_t(file_size) == sizeof(header) + uint64_t(header.vertex_count) * sizeof(MeshVertex) + uint64_t(header.index_count) * sizeof(uint16_t);
+    ok = ok && memcmp(header.magic, "EEMC", 4) == 0 && header.version == cache_version && header.vertex_size == sizeof(MeshVertex);
+    ok = ok && header.source_hash == source_hash && header.source_size == source_size;
+    // Meshes with too many vertices for 16 bit indices are stored without indices.
+    ok = ok && (header.index_count == header.face_count * 3 || (header.index_count == 0 && header.vertex_count >= header.face_count * 3));
+    if (ok)
+    {
+        vertices.resize(header.vertex_count);
+        indices.resize(header.index_count);
+        ok = fread(vertices.data(), sizeof(MeshVertex), vertices.size(), f) == vertices.size();
+        ok = ok && fread(indices.data(), sizeof(uint16_t), indices.size(), f) == indices.size();
+        ok = ok && std::all_of(indices.begin(), indices.end(), [this](uint16_t index) { return index < vertices.size(); });
+    }
+    fclose(f);
+    if (!ok)
+    {
+        // Outdated or damaged, it will be replaced.
+        vertices.clear();
+        indices.clear();
+        return false;
+    }
+    face_count = header.face_count;
+    greatest_distance_from_center = header.greatest_distance_from_center;
+    return true;
+}
+
+void Mesh::saveCache(const string& cache_file, uint64_t source_hash, uint64_t source_size)
+{
+    CacheHeader header{};
+    memcpy(header.magic, "EEMC", 4);
+    header.version = cache_version;
+    header.vertex_size = sizeof(MeshVertex);
+    header.face_count = face_count;
+    header.source_hash = source_hash;
+    header.source_size = source_size;
+    header.vertex_count = uint32_t(vertices.size());
+    header.index_count = indices.empty() ? 0 : face_count * 3;
+    header.greatest_distance_from_center = greatest_distance_from_center;
+
+    // Write to a temporary file first, so an interrupted write never leaves a cache file that looks valid.
+    string tmp_file = cache_file + ".tmp";
+    FILE* f = fopen(tmp_file.c_str(), "wb");
+    if (!f)
+        return;
+    bool ok = fwrite(&header, sizeof(header), 1, f) == 1;
+    ok = ok && fwrite(vertices.data(), sizeof(MeshVertex), vertices.size(), f) == vertices.size();
+    ok = ok && fwrite(indices.data(), sizeof(uint16_t), header.index_count, f) == header.index_count;
+    ok = fclose(f) == 0 && ok;
+    if (ok)
+    {
+        remove(cache_file.c_str());
+        ok = rename(tmp_file.c_str(), cache_file.c_str()) == 0;
+    }
+    if (!ok)
+    {
+        LOG(WARNING) << "Failed to write mesh cache " << cache_file;
+        remove(tmp_file.c_str());
+    }
+}
+
+std::vector<MeshVertex> Mesh::loadVertices(const string& filename, const P<ResourceStream>& stream)
+{
     std::vector<MeshVertex> mesh_vertices;
     if (filename.endswith(".obj"))
     {
@@ -302,12 +615,5 @@ Mesh* Mesh::getMesh(const string& filename)
         LOG(ERROR) << "Unknown mesh format: " << filename;
     }
 
-    if (!mesh_vertices.empty())
-    {
-        ret = new Mesh(std::move(mesh_vertices));
-        meshMap[filename] = ret;
-    }
-
-
-    return ret;
+    return mesh_vertices;
 }
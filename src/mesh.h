@@ -4,6 +4,7 @@
 #include "nonCopyable.h"
 #include "stringImproved.h"
 #include "glObjects.h"
+#include "resources.h"
 
 #include <glm/vec3.hpp>
 
@@ -20,18 +21,63 @@ class Mesh : sp::NonCopyable
     std::vector<uint16_t> indices;
     gl::Buffers<2> vbo_ibo{ gl::Unitialized{} };
     uint32_t face_count{};
+    bool ready = false;
+    bool failed = false;
+
+    Mesh() = default;
+    // Index the vertices and calculate the bounds. Does not touch GL, so this can run on a loader thread.
+    void build(std::vector<MeshVertex>&& unindexed_vertices);
+    // Load and build the mesh from the cache or the source file, also without touching GL.
+    bool load(const string& filename);
+    // Create the GL buffers, must be called from the main thread.
+    void upload();
+
+    bool loadCache(const string& cache_file, uint64_t source_hash, uint64_t source_size);
+    void saveCache(const string& cache_file, uint64_t source_hash, uint64_t source_size);
+
+    static std::vector<MeshVertex> loadVertices(const string& filename, const P<ResourceStream>& stream);
+    static void loaderThread();
+
+    static string cache_path;
 public:
+    // Time per frame that uploadLoaded spends on uploading meshes, in seconds.
+    static constexpr float default_upload_budget = 0.002f;
+
     float greatest_distance_from_center{};
     explicit Mesh(std::vector<MeshVertex>&& vertices);
 
+    // Meshes requested with getMeshAsync are not ready until they are loaded and uploaded, render does nothing until then.
+    bool isReady() const { return ready; }
+    // Set when a mesh requested with getMeshAsync failed to load in the background. Pointers obtained before that stay valid.
+    bool isFailed() const { return failed; }
+
     void render(int32_t position_attrib, int32_t texcoords_attrib, int32_t normal_attrib);
+    // Split up version of render, to draw the same mesh multiple times without binding it again.
+    //  bind returns false if the mesh cannot be drawn, in which case nothing is bound.
+    bool bind(int32_t position_attrib, int32_t texcoords_attrib, int32_t normal_attrib);
+    void draw();
+    static void unbind();
     glm::vec3 randomPoint();
 
     // Calculate the center all vertices in this mesh, and return the distance
     // of the point farthest from that center.
     float greatestDistanceFromCenter(std::vector<MeshVertex>& vertices);
 
+    // Load the mesh right away. If the mesh is being loaded in the background, this waits for it.
     static Mesh* getMesh(const string& filename);
+    // Start loading the mesh on a loader thread if it is not loaded yet, and return right away.
+    //  Returns nullptr if the mesh is known to have failed to load.
+    static Mesh* getMeshAsync(const string& filename);
+    // Warm the cache with a mesh that will be needed later, for example during scenario loading.
+    static void prefetch(const string& filename) { getMeshAsync(filename); }
+    // Upload meshes that finished loading in the background, until the time budget is used up.
+    //  This needs the GL context, so it is called from the render code.
+    static void uploadLoaded(float time_budget = default_upload_budget);
+
+    // Built meshes are cached in this directory, so the next start does not need to parse and index them again.
+    //  The cache files are keyed on the mesh name and store a hash of the source, so a changed source is detected.
+    //  Must be set before any mesh is loaded. Without a cache path, nothing is cached.
+    static void setCachePath(const string& path);
 };
 
 #endif//MESH_H
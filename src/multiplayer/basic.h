@@ -3,6 +3,8 @@
 #include "ecs/multiplayer.h"
 #include "ecs/query.h"
 #include "engine.h"
+#include "multiplayer/interest.h"
+#include "profiler.h"
 
 
 namespace sp::io {
@@ -24,7 +26,7 @@ enum class BasicReplicationRequest {
         void receive(sp::ecs::Entity entity, sp::io::DataBuffer& packet) override; \
         void remove(sp::ecs::Entity entity) override; \
         template<BasicReplicationRequest> bool impl(sp::ecs::Entity entity, sp::io::DataBuffer& packet, COMPONENT& c, COMPONENT* backup); \
-        template<BasicReplicationRequest> void field_impl(sp::ecs::Entity entity, sp::io::DataBuffer& packet, COMPONENT& c, COMPONENT* backup, sp::io::DataBuffer& tmp, uint64_t& flags); \
+        template<BasicReplicationRequest, bool WRITE> void field_impl(sp::ecs::Entity entity, sp::io::DataBuffer& packet, COMPONENT& c, COMPONENT* backup, uint64_t& flags, bool& written); \
     };
 #define BASIC_REPLICATION_CLASS(CLASS, COMPONENT) \
     BASIC_REPLICATION_CLASS_RATE(CLASS, COMPONENT, 60.0f);
@@ -37,6 +39,7 @@ enum class BasicReplicationRequest {
         } \
     } \
     void CLASS::update(sp::io::DataBuffer& packet) { \
+        Profiler::Scope profile_scope(#CLASS); \
         auto now = engine->getElapsedTime(); \
         for(auto [entity, data] : sp::ecs::Query<COMPONENT>()) { \
             if (!info.has(entity.getIndex())) { \
@@ -47,7 +50,7 @@ enum class BasicReplicationRequest {
                 if (entity_info.version != entity.getVersion()) { \
                     info.set(entity.getIndex(), {entity.getVersion(), now, data}); \
                     impl<BasicReplicationRequest::SendAll>(entity, packet, data, nullptr); \
-                } else if (entity_info.last_update + update_delay <= now) { \
+                } else if (entity_info.last_update + ReplicationInterest::getUpdateDelay(entity, update_delay) <= now) { \
                     if (impl<BasicReplicationRequest::Update>(entity, packet, data, &entity_info.data)) entity_info.last_update = now; \
                 } \
             } \
@@ -62,27 +65,38 @@ enum class BasicReplicationRequest {
     void CLASS::receive(sp::ecs::Entity entity, sp::io::DataBuffer& packet) { impl<BasicReplicationRequest::Receive>(entity, packet, entity.getOrAddComponent<COMPONENT>(), nullptr); } \
     void CLASS::remove(sp::ecs::Entity entity) { entity.removeComponent<COMPONENT>(); } \
     template<BasicReplicationRequest BRR> bool CLASS::impl(sp::ecs::Entity entity, sp::io::DataBuffer& packet, COMPONENT& target, COMPONENT* backup) { \
-        sp::io::DataBuffer tmp; \
         uint64_t flags = 0; \
-        if (BRR == BasicReplicationRequest::Receive) packet >> flags; \
-        field_impl<BRR>(entity, packet, target, backup, tmp, flags); \
-        if (tmp.getDataSize() > 0) packet.write(CMD_ECS_SET_COMPONENT, component_index, entity.getIndex(), flags, tmp); \
-        return tmp.getDataSize() > 0; \
+        bool written = false; \
+        if (BRR == BasicReplicationRequest::Receive) { \
+            packet >> flags; \
+            field_impl<BRR, true>(entity, packet, target, backup, flags, written); \
+            return true; \
+        } \
+        field_impl<BRR, false>(entity, packet, target, backup, flags, written); \
+        if (flags == 0 && !written) return false; \
+        packet.write(CMD_ECS_SET_COMPONENT, component_index, entity.getIndex(), flags); \
+        written = false; \
+        field_impl<BRR, true>(entity, packet, target, backup, flags, written); \
+        return true; \
     } \
-    template<BasicReplicationRequest BRR> void CLASS::field_impl(sp::ecs::Entity entity, sp::io::DataBuffer& packet, COMPONENT& target, COMPONENT* backup, sp::io::DataBuffer& tmp, uint64_t& flags) { \
+    template<BasicReplicationRequest BRR, bool WRITE> void CLASS::field_impl(sp::ecs::Entity entity, sp::io::DataBuffer& packet, COMPONENT& target, COMPONENT* backup, uint64_t& flags, bool& written) { \
         uint64_t flag = 1;
 
+// The fields are processed in two passes, so they can be written directly into the packet without a temporary buffer.
+//  The first pass (WRITE=false) only figures out which fields changed, so the flags can be written before the fields.
+//  The second pass (WRITE=true) writes the changed fields and updates the backup. Receiving only uses the second pass.
+//  Vector elements have their own flags, and go trough the same two steps per element.
 #define BASIC_REPLICATION_FIELD(FIELD) \
     switch(BRR) { \
-    case BasicReplicationRequest::SendAll: flags |= flag; tmp << target.FIELD; break; \
-    case BasicReplicationRequest::Update: if (target.FIELD != backup->FIELD) { flags |= flag; tmp << target.FIELD; backup->FIELD = target.FIELD; } break; \
+    case BasicReplicationRequest::SendAll: flags |= flag; if (WRITE) { packet << target.FIELD; written = true; } break; \
+    case BasicReplicationRequest::Update: if (!WRITE) { if (target.FIELD != backup->FIELD) flags |= flag; } else if (flags & flag) { packet << target.FIELD; backup->FIELD = target.FIELD; written = true; } break; \
     case BasicReplicationRequest::Receive: if (flags & flag) packet >> target.FIELD; break; \
     } \
     flag <<= 1;
 #define BASIC_REPLICATION_VECTOR(FIELD) \
     switch(BRR) { \
-    case BasicReplicationRequest::SendAll: flags |= flag; tmp << target.FIELD.size(); break; \
-    case BasicReplicationRequest::Update: if (target.FIELD.size() != backup->FIELD.size()) { flags |= flag; tmp << target.FIELD.size(); backup->FIELD.resize(target.FIELD.size()); } break; \
+    case BasicReplicationRequest::SendAll: flags |= flag; if (WRITE) { packet << target.FIELD.size(); written = true; } break; \
+    case BasicReplicationRequest::Update: if (!WRITE) { if (target.FIELD.size() != backup->FIELD.size()) { flags |= flag; backup->FIELD.resize(target.FIELD.size()); } } else if (flags & flag) { packet << target.FIELD.size(); written = true; } break; \
     case BasicReplicationRequest::Receive: if (flags & flag) { size_t size; packet >> size; target.FIELD.resize(size); } break; \
     } \
     flag <<= 1; \
@@ -96,21 +110,27 @@ enum class BasicReplicationRequest {
         } \
         auto vector_target = &target.FIELD[idx]; \
         auto vector_backup = backup ? &backup->FIELD[idx] : nullptr; \
-        sp::io::DataBuffer vector_tmp; \
-        uint32_t vector_flag = 1;
+        for(int vector_pass = (BRR == BasicReplicationRequest::Receive) ? 1 : 0; vector_pass < 2; vector_pass++) { \
+            if (vector_pass == 1 && BRR != BasicReplicationRequest::Receive) { \
+                if (vector_flags == 0) break; \
+                written = true; \
+                if (!WRITE) break; \
+                packet << vector_flags << idx; \
+            } \
+            uint32_t vector_flag = 1;
 
 #define VECTOR_REPLICATION_FIELD(FIELD) \
-        switch(BRR) { \
-        case BasicReplicationRequest::SendAll: vector_flags |= vector_flag; vector_tmp << vector_target->FIELD; break; \
-        case BasicReplicationRequest::Update: if (vector_target->FIELD != vector_backup->FIELD) { vector_flags |= vector_flag; vector_tmp << vector_target->FIELD; vector_backup->FIELD = vector_target->FIELD; } break; \
-        case BasicReplicationRequest::Receive: if (vector_flags & vector_flag) packet >> vector_target->FIELD; break; \
-        } \
-        vector_flag <<= 1;
+            switch(BRR) { \
+            case BasicReplicationRequest::SendAll: vector_flags |= vector_flag; if (vector_pass == 1) packet << vector_target->FIELD; break; \
+            case BasicReplicationRequest::Update: if (vector_pass == 0) { if (vector_target->FIELD != vector_backup->FIELD) vector_flags |= vector_flag; } else if (vector_flags & vector_flag) { packet << vector_target->FIELD; vector_backup->FIELD = vector_target->FIELD; } break; \
+            case BasicReplicationRequest::Receive: if (vector_flags & vector_flag) packet >> vector_target->FIELD; break; \
+            } \
+            vector_flag <<= 1;
 
 #define VECTOR_REPLICATION_END() \
-        if (vector_tmp.getDataSize() > 0) tmp.write(vector_flags, idx, vector_tmp); \
+        } \
     } \
-    if (tmp.getDataSize() > 0) tmp.write(uint32_t(0)); // end of vector update.
+    if (WRITE && written && BRR != BasicReplicationRequest::Receive) packet << uint32_t(0); // end of vector update.
 
 
 
@@ -122,6 +142,7 @@ enum class BasicReplicationRequest {
         } \
     } \
     void CLASS::update(sp::io::DataBuffer& packet) { \
+        Profiler::Scope profile_scope(#CLASS); \
         auto now = engine->getElapsedTime(); \
         for(auto [entity, data] : sp::ecs::Query<COMPONENT>()) { \
             if (!info.has(entity.getIndex())) { \
@@ -147,8 +168,8 @@ enum class BasicReplicationRequest {
 
 #define REPLICATE_VECTOR_IF_DIRTY(VECTOR, DIRTY) \
     switch(BRR) { \
-    case BasicReplicationRequest::SendAll: flags |= flag; tmp << target.VECTOR; break; \
-    case BasicReplicationRequest::Update: if (target.DIRTY) { flags |= flag; tmp << target.VECTOR; target.DIRTY = false; } break; \
+    case BasicReplicationRequest::SendAll: flags |= flag; if (WRITE) { packet << target.VECTOR; written = true; } break; \
+    case BasicReplicationRequest::Update: if (!WRITE) { if (target.DIRTY) flags |= flag; } else if (flags & flag) { packet << target.VECTOR; target.DIRTY = false; written = true; } break; \
     case BasicReplicationRequest::Receive: if (flags & flag) packet >> target.VECTOR; break; \
     } \
     flag <<= 1;
@@ -0,0 +1,102 @@
+#include "multiplayer/interest.h"
+#include "playerInfo.h"
+#include "engine.h"
+#include "ecs/query.h"
+#include "components/collision.h"
+#include "components/radar.h"
+#include "components/faction.h"
+#include <glm/gtx/norm.hpp>
+
+
+float ReplicationInterest::last_update_time = -1.0f;
+bool ReplicationInterest::everything = true;
+std::vector<ReplicationInterest::Area> ReplicationInterest::areas;
+sp::Bitset ReplicationInterest::interesting;
+
+
+bool ReplicationInterest::isInteresting(sp::ecs::Entity entity)
+{
+    // All replication classes ask during the same frame, so only build the interest set once per frame.
+    if (last_update_time != engine->getElapsedTime())
+        update();
+    if (everything || interesting.has(entity.getIndex()))
+        return true;
+    // Entities without a position, like factions, cannot be out of range.
+    return !entity.hasComponent<sp::Transform>();
+}
+
+float ReplicationInterest::getUpdateDelay(sp::ecs::Entity entity, float update_delay)
+{
+    if (update_delay >= out_of_interest_delay || isInteresting(entity))
+        return update_delay;
+    return out_of_interest_delay;
+}
+
+void ReplicationInterest::update()
+{
+    last_update_time = engine->getElapsedTime();
+    everything = false;
+    areas.clear();
+    interesting = sp::Bitset();
+
+    std::vector<sp::ecs::Entity> ships;
+    foreach(PlayerInfo, info, player_info_list)
+    {
+        // The server itself has client id 0, and does not need replication.
+        if (info->client_id == 0)
+            continue;
+        if (!info->ship)
+        {
+            everything = true;
+            return;
+        }
+        ships.push_back(info->ship);
+    }
+
+    for(auto ship : ships)
+    {
+        interesting.set(ship.getIndex());
+        auto lrr = ship.getComponent<LongRangeRadar>();
+        float range = lrr ? lrr->long_range : 30000.0f;
+        addArea(ship, range);
+        if (lrr && lrr->radar_view_linked_entity)
+            addArea(lrr->radar_view_linked_entity, range);
+    }
+    if (!ships.empty())
+    {
+        for(auto [entity, share, transform] : sp::ecs::Query<ShareShortRangeRadar, sp::Transform>())
+        {
+            for(auto ship : ships)
+            {
+                if (Faction::getRelation(ship, entity) == FactionRelation::Friendly)
+                {
+                    auto lrr = entity.getComponent<LongRangeRadar>();
+                    addArea(entity, lrr ? lrr->short_range : 5000.0f);
+                    break;
+                }
+            }
+        }
+    }
+
+    for(auto [entity, transform] : sp::ecs::Query<sp::Transform>())
+    {
+        auto position = transform.getPosition();
+        for(auto& area : areas)
+        {
+            if (glm::length2(position - area.position) < area.range * area.range)
+            {
+                interesting.set(entity.getIndex());
+                break;
+            }
+        }
+    }
+}
+
+void ReplicationInterest::addArea(sp::ecs::Entity entity, float range)
+{
+    auto transform = entity.getComponent<sp::Transform>();
+    if (!transform)
+        return;
+    range += interest_margin;
+    areas.push_back({transform->getPosition(), range});
+}
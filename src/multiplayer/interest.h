@@ -0,0 +1,45 @@
+#pragma once
+
+#include "ecs/entity.h"
+#include "container/bitset.h"
+#include <glm/vec2.hpp>
+#include <vector>
+
+
+// Keeps track of which entities could be of interest to any of the connected clients.
+//  A client crewing a ship is interested in everything within the long range radar of that ship, of the entity that
+//  the radar view is linked to, and around every friendly entity that shares its short range radar (for relay).
+//  Clients without a ship (game master, spectator, ship selection) are interested in everything, so while any of
+//  those is connected nothing is throttled, for any client.
+// The basic replication sends updates of entities outside of the interest of every client at a much lower rate.
+//  They are still send, so clients keep a complete, but less up to date, picture of the world.
+//  When an entity comes back into interest it is send at the normal rate again, still as a delta against the last send state.
+// Only components replicated with BASIC_REPLICATION_IMPL are throttled. The replication of sp::Transform and sp::Physics
+//  is part of SeriousProton and still sends every entity at the full rate, and that is most of the traffic.
+class ReplicationInterest
+{
+public:
+    // Updates for entities that no client is interested in are send at this interval.
+    static constexpr float out_of_interest_delay = 1.0f;
+    // Extra range around every area of interest, so an entity already has fresh data when it comes into view.
+    static constexpr float interest_margin = 5000.0f;
+
+    static bool isInteresting(sp::ecs::Entity entity);
+    // Get the update interval for an entity, given the normal interval of the component.
+    static float getUpdateDelay(sp::ecs::Entity entity, float update_delay);
+
+private:
+    struct Area
+    {
+        glm::vec2 position;
+        float range;
+    };
+
+    static float last_update_time;
+    static bool everything;
+    static std::vector<Area> areas;
+    static sp::Bitset interesting;
+
+    static void update();
+    static void addArea(sp::ecs::Entity entity, float range);
+};
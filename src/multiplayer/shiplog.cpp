@@ -1,6 +1,7 @@
 #include "multiplayer/shiplog.h"
 #include "ecs/query.h"
 #include "components/shiplog.h"
+#include "profiler.h"
 
 static constexpr unsigned int FULL_UPDATE = 0;
 static constexpr unsigned int ADDITION = 1;
@@ -20,6 +21,7 @@ void ShipLogReplication::sendAll(sp::io::DataBuffer& packet)
 
 void ShipLogReplication::update(sp::io::DataBuffer& packet)
 {
+    Profiler::Scope profile_scope("ShipLogReplication");
     for(auto [entity, log] : sp::ecs::Query<ShipLog>()) {
         if (log.cleared) {
             addFullUpdate(packet, entity, log);
@@ -1,15 +1,10 @@
 #include "packResourceProvider.h"
 
 #include <cstdio>
+#include <cstring>
 #include <SDL_endian.h>
 #include <SDL_rwops.h>
 
-#ifdef _WIN32
-#include <malloc.h>
-#else
-#include <alloca.h>
-#endif
-
 #ifdef ANDROID
 #include <jni.h>
 #include <android/asset_manager.h>
@@ -19,64 +14,400 @@
 #include <filesystem>
 #endif
 
-static inline int readInt(SDL_RWops* f)
+#ifdef _WIN32
+#include <windows.h>
+#elif !defined(ANDROID)
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+#endif
+
+
+static inline uint32_t readBE32(const uint8_t* ptr)
+{
+    uint32_t value;
+    memcpy(&value, ptr, sizeof(value));
+    return SDL_SwapBE32(value);
+}
+
+static inline uint64_t readBE64(const uint8_t* ptr)
+{
+    uint64_t value;
+    memcpy(&value, ptr, sizeof(value));
+    return SDL_SwapBE64(value);
+}
+
+// FNV-1a, pack_gen.py uses the same hash for the directory.
+static uint32_t hashName(const char* name, size_t length)
+{
+    uint32_t hash = 2166136261u;
+    for(size_t n=0; n<length; n++)
+    {
+        hash ^= uint8_t(name[n]);
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+// Decompress a raw LZ4 block (no frame header). Returns false if the data is corrupt or does not decompress to exactly the expected size.
+static bool decompressLZ4(const uint8_t* src, size_t src_size, uint8_t* dst, size_t dst_size)
 {
-    int32_t ret = 0;
-    SDL_RWread(f, &ret, sizeof(int32_t), 1);
-    return SDL_SwapBE32(ret);
+    const uint8_t* ip = src;
+    const uint8_t* iend = src + src_size;
+    uint8_t* op = dst;
+    uint8_t* oend = dst + dst_size;
+    auto readLength = [&ip, iend](size_t& length)
+    {
+        uint8_t b;
+        do {
+            if (ip >= iend)
+                return false;
+            b = *ip++;
+            length += b;
+        } while(b == 255);
+        return true;
+    };
+    while(ip < iend)
+    {
+        unsigned int token = *ip++;
+        size_t literal_length = token >> 4;
+        if (literal_length == 15 && !readLength(literal_length))
+            return false;
+        if (size_t(iend - ip) < literal_length || size_t(oend - op) < literal_length)
+            return false;
+        memcpy(op, ip, literal_length);
+        ip += literal_length;
+        op += literal_length;
+        // The last sequence only has literals.
+        if (ip >= iend)
+            break;
+
+        if (iend - ip < 2)
+            return false;
+        size_t offset = size_t(ip[0]) | (size_t(ip[1]) << 8);
+        ip += 2;
+        if (offset == 0 || offset > size_t(op - dst))
+            return false;
+        size_t match_length = token & 15;
+        if (match_length == 15 && !readLength(match_length))
+            return false;
+        match_length += 4;
+        if (size_t(oend - op) < match_length)
+            return false;
+        // The match can overlap with the output, so copy byte by byte.
+        const uint8_t* match = op - offset;
+        for(size_t n=0; n<match_length; n++)
+            op[n] = match[n];
+        op += match_length;
+    }
+    return op == oend;
 }
 
-static inline string readString(SDL_RWops *f)
+// Simple glob match, '*' matches any number of characters except '/', '?' matches a single character.
+static bool globMatch(const char* name, const char* name_end, const char* pattern)
 {
-    int8_t len = 0;
-    SDL_RWread(f, &len, sizeof(int8_t), 1);
-    // MFC - MSVC doesn't support non-const [] initializers
-    char *buffer = (char*)alloca(len + 1);
-    SDL_RWread(f, buffer, len, 1);
-    buffer[len] = '\0';
-    return string(buffer);
+    while(*pattern)
+    {
+        if (*pattern == '*')
+        {
+            pattern++;
+            for(const char* p = name; ; p++)
+            {
+                if (globMatch(p, name_end, pattern))
+                    return true;
+                if (p == name_end || *p == '/')
+                    return false;
+            }
+        }
+        if (name == name_end)
+            return false;
+        if (*pattern != '?' && *pattern != *name)
+            return false;
+        pattern++;
+        name++;
+    }
+    return name == name_end;
 }
 
 PackResourceProvider::PackResourceProvider(string filename)
 : filename(filename)
 {
-    auto f = SDL_RWFromFile(filename.c_str(), "rb");
-    if (!f)
+    if (!open())
+        return;
+
+    uint8_t header[12];
+    if (!readAt(0, header, 8))
     {
-        LOG(WARNING) << "Failed to open " << filename << ": " << SDL_GetError();
+        LOG(WARNING) << filename << " is not a pack file";
+        return;
+    }
+    version = int32_t(readBE32(header));
+    int32_t file_count = int32_t(readBE32(header + 4));
+    bool ok = file_count >= 0;
+    if (ok && version == 0)
+        ok = loadIndexV0(file_count);
+    else if (ok && version == 1)
+        ok = readAt(8, header + 8, 4) && loadDirectoryV1(file_count, readBE32(header + 8));
+    else if (ok)
+    {
+        LOG(WARNING) << filename << " has unknown version " << version;
+        return;
+    }
+    if (!ok)
+    {
+        LOG(WARNING) << filename << " has an invalid index";
+        files.clear();
+        directory.clear();
+        entry_count = 0;
         return;
     }
+    LOG(INFO) << "Loaded: " << filename << " with " << file_count << " files";
+}
+
+bool PackResourceProvider::loadIndexV0(int32_t file_count)
+{
+    // Version 0 has a list of variable length entries, directly after the file count.
+    size_t header_position = 8;
+    files.reserve(file_count);
+    char name[256];
+    uint8_t buffer[8];
+    for(int n=0; n<file_count; n++)
+    {
+        uint8_t name_length = 0;
+        if (!readAt(header_position, &name_length, sizeof(name_length)))
+            return false;
+        header_position += sizeof(name_length);
+        if (!readAt(header_position, name, name_length) || !readAt(header_position + name_length, buffer, 8))
+            return false;
+        header_position += name_length + 8;
+        PackResourceInfo info(readBE32(buffer), readBE32(buffer + 4));
+        if (!isValid(info))
+            return false;
+        files.emplace(string(std::string(name, name_length)), info);
+    }
+    return true;
+}
+
+bool PackResourceProvider::loadDirectoryV1(int32_t file_count, uint32_t string_table_size)
+{
+    // The whole directory is copied in one go and used as is, lookups do a binary search on the name hashes.
+    entry_count = size_t(file_count);
+    if (directory_offset + entry_count * directory_entry_size + string_table_size > getFileSize())
+        return false;
+    directory.resize(directory_offset + entry_count * directory_entry_size + string_table_size);
+    if (!readAt(0, directory.data(), directory.size()))
+        return false;
+
+    uint32_t previous_hash = 0;
+    for(size_t index=0; index<entry_count; index++)
+    {
+        auto entry = directory.data() + directory_offset + index * directory_entry_size;
+        uint32_t hash = readBE32(entry);
+        uint64_t name_offset = readBE32(entry + 4);
+        uint64_t name_length = readBE32(entry + 8);
+        if (hash < previous_hash || name_offset + name_length > directory.size())
+            return false;
+        if (hashName(reinterpret_cast<const char*>(directory.data() + name_offset), name_length) != hash)
+            return false;
+        if (!isValid(getDirectoryEntry(index)))
+            return false;
+        previous_hash = hash;
+    }
+    return true;
+}
+
+bool PackResourceProvider::isValid(const PackResourceInfo& info)
+{
+    if (info.compression != PackResourceInfo::Compression::None && info.compression != PackResourceInfo::Compression::LZ4)
+        return false;
+    if (info.compression == PackResourceInfo::Compression::None && info.stored_size != info.size)
+        return false;
+#ifndef ANDROID
+    if (info.position > data_size || info.stored_size > data_size - info.position)
+        return false;
+#endif
+    return true;
+}
 
-    int version = readInt(f);
+PackResourceInfo PackResourceProvider::getDirectoryEntry(size_t index)
+{
+    auto entry = directory.data() + directory_offset + index * directory_entry_size;
+    PackResourceInfo info(readBE64(entry + 16), readBE64(entry + 32));
+    info.compression = PackResourceInfo::Compression(readBE32(entry + 12));
+    info.stored_size = readBE64(entry + 24);
+    return info;
+}
+
+bool PackResourceProvider::findEntry(const string& name, PackResourceInfo& info)
+{
     if (version == 0)
     {
-        int file_count = readInt(f);
-        LOG(INFO) << "Loaded: " << filename << " with " << file_count << " files";
-        for(int n=0; n<file_count; n++)
+        auto it = files.find(name);
+        if (it == files.end())
+            return false;
+        info = it->second;
+        return true;
+    }
+
+    auto hash = hashName(name.data(), name.size());
+    size_t low = 0;
+    size_t high = entry_count;
+    while(low < high)
+    {
+        size_t middle = (low + high) / 2;
+        if (readBE32(directory.data() + directory_offset + middle * directory_entry_size) < hash)
+            low = middle + 1;
+        else
+            high = middle;
+    }
+    for(; low < entry_count; low++)
+    {
+        auto entry = directory.data() + directory_offset + low * directory_entry_size;
+        if (readBE32(entry) != hash)
+            break;
+        auto name_length = readBE32(entry + 8);
+        if (name_length == name.size() && memcmp(directory.data() + readBE32(entry + 4), name.data(), name_length) == 0)
         {
-            string fileName = readString(f);
-            int position = readInt(f);
-            int size = readInt(f);
-            files[fileName] = PackResourceInfo(position, size);
+            info = getDirectoryEntry(low);
+            return true;
         }
     }
-    else
+    return false;
+}
+
+bool PackResourceProvider::open()
+{
+#ifdef ANDROID
+    f = SDL_RWFromFile(filename.c_str(), "rb");
+    if (!f)
+    {
+        LOG(WARNING) << "Failed to open " << filename << ": " << SDL_GetError();
+        return false;
+    }
+    return true;
+#elif defined(_WIN32)
+    auto file = CreateFileW(std::filesystem::u8path(filename.c_str()).c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE)
     {
-        LOG(WARNING) << filename << " has unknown version " << version;
+        LOG(WARNING) << "Failed to open " << filename << ": error " << GetLastError();
+        return false;
+    }
+    LARGE_INTEGER file_size;
+    HANDLE mapping = nullptr;
+    if (GetFileSizeEx(file, &file_size) && file_size.QuadPart > 0)
+        mapping = CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (mapping)
+    {
+        data = static_cast<const uint8_t*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+        data_size = size_t(file_size.QuadPart);
+    }
+    // The view keeps a reference to the mapping and the file, so the handles are not needed anymore.
+    if (mapping)
+        CloseHandle(mapping);
+    CloseHandle(file);
+    if (!data)
+    {
+        LOG(WARNING) << "Failed to map " << filename << ": error " << GetLastError();
+        return false;
     }
-    SDL_RWclose(f);
+    return true;
+#else
+    int fd = ::open(filename.c_str(), O_RDONLY);
+    if (fd < 0)
+    {
+        LOG(WARNING) << "Failed to open " << filename << ": " << strerror(errno);
+        return false;
+    }
+    struct stat st;
+    void* mapping = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && st.st_size > 0)
+        mapping = mmap(nullptr, size_t(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+    // The mapping keeps its own reference to the file.
+    ::close(fd);
+    if (mapping == MAP_FAILED)
+    {
+        LOG(WARNING) << "Failed to map " << filename << ": " << strerror(errno);
+        return false;
+    }
+    data = static_cast<const uint8_t*>(mapping);
+    data_size = size_t(st.st_size);
+    return true;
+#endif
+}
+
+size_t PackResourceProvider::getFileSize()
+{
+#ifdef ANDROID
+    auto size = SDL_RWsize(f);
+    return size < 0 ? 0 : size_t(size);
+#else
+    return data_size;
+#endif
+}
+
+bool PackResourceProvider::readAt(size_t position, void* buffer, size_t size)
+{
+#ifdef ANDROID
+    std::lock_guard<std::mutex> lock(file_mutex);
+    if (SDL_RWseek(f, position, RW_SEEK_SET) < 0)
+        return false;
+    return size == 0 || SDL_RWread(f, buffer, size, 1) == 1;
+#else
+    if (position + size > data_size)
+        return false;
+    memcpy(buffer, data + position, size);
+    return true;
+#endif
 }
 
 P<ResourceStream> PackResourceProvider::getResourceStream(const string filename)
 {
-    if (files.find(filename) != files.end())
-        return new PackResourceStream(this->filename, files.find(filename)->second);
-    return NULL;
+    PackResourceInfo info;
+    if (!findEntry(filename, info))
+        return NULL;
+    if (info.compression == PackResourceInfo::Compression::None)
+        return new PackResourceStream(this, info);
+
+    // Compressed entries are decompressed as a whole when they are opened.
+    std::vector<uint8_t> buffer(info.size);
+#ifdef ANDROID
+    std::vector<uint8_t> stored(info.stored_size);
+    if (!readAt(info.position, stored.data(), stored.size()))
+        return NULL;
+    const uint8_t* stored_data = stored.data();
+#else
+    const uint8_t* stored_data = data + info.position;
+#endif
+    if (!decompressLZ4(stored_data, info.stored_size, buffer.data(), buffer.size()))
+    {
+        LOG(WARNING) << "Failed to decompress " << filename << " from " << this->filename;
+        return NULL;
+    }
+    auto stream = new PackResourceStream(this, info);
+    stream->buffer = std::move(buffer);
+    return stream;
 }
 
 std::vector<string> PackResourceProvider::findResources(const string searchPattern)
 {
     std::vector<string> ret;
+    if (version == 0)
+    {
+        for(auto& it : files)
+            if (globMatch(it.first.data(), it.first.data() + it.first.size(), searchPattern.c_str()))
+                ret.push_back(it.first);
+        return ret;
+    }
+    for(size_t index=0; index<entry_count; index++)
+    {
+        auto entry = directory.data() + directory_offset + index * directory_entry_size;
+        auto name = reinterpret_cast<const char*>(directory.data() + readBE32(entry + 4));
+        auto name_length = readBE32(entry + 8);
+        if (globMatch(name, name + name_length, searchPattern.c_str()))
+            ret.push_back(string(std::string(name, name_length)));
+    }
     return ret;
 }
 
@@ -143,34 +474,37 @@ void PackResourceProvider::addPackResourcesForDirectory(const string directory)
 #endif
 }
 
-PackResourceStream::PackResourceStream(string filename, PackResourceInfo info)
-: position(info.position), size(info. size)
-{
-    f = SDL_RWFromFile(filename.c_str(), "rb");
-    if (!f)
-        destroy();
-    else
-        seek(0);
-}
-PackResourceStream::~PackResourceStream()
+PackResourceStream::PackResourceStream(PackResourceProvider* provider, PackResourceInfo info)
+: provider(provider), position(info.position), size(info.size)
 {
-    if (f)
-        SDL_RWclose(f);
 }
 
 size_t PackResourceStream::read(void* data, size_t size)
 {
     if (read_position + size > this->size)
         size = this->size - read_position;
-    auto ret = SDL_RWread(f, data, 1, size);
-    read_position += ret;
-    return ret;
+    if (!buffer.empty())
+    {
+        memcpy(data, buffer.data() + read_position, size);
+        read_position += size;
+        return size;
+    }
+#ifdef ANDROID
+    {
+        std::lock_guard<std::mutex> lock(provider->file_mutex);
+        SDL_RWseek(provider->f, position + read_position, RW_SEEK_SET);
+        size = SDL_RWread(provider->f, data, 1, size);
+    }
+#else
+    memcpy(data, provider->data + position + read_position, size);
+#endif
+    read_position += size;
+    return size;
 }
 
 size_t PackResourceStream::seek(size_t position)
 {
-    read_position = position;
-    SDL_RWseek(f, this->position + read_position, RW_SEEK_SET);
+    read_position = position < size ? position : size;
     return read_position;
 }
 
@@ -183,3 +517,14 @@ size_t PackResourceStream::getSize()
 {
     return size;
 }
+
+const uint8_t* PackResourceStream::getData()
+{
+    if (!buffer.empty())
+        return buffer.data();
+#ifdef ANDROID
+    return nullptr;
+#else
+    return provider->data + position;
+#endif
+}
@@ -3,20 +3,70 @@
 
 #include "resources.h"
 #include <unordered_map>
+#include <mutex>
+#include <vector>
 
 struct PackResourceInfo
 {
+    enum class Compression
+    {
+        None = 0,
+        LZ4 = 1,
+    };
+
     PackResourceInfo() {}
-    PackResourceInfo(size_t position, size_t size) : position(position), size(size) {}
+    PackResourceInfo(size_t position, size_t size) : position(position), size(size), stored_size(size) {}
 
-    size_t position;
-    size_t size;
+    size_t position = 0;
+    // Size of the resource after decompression.
+    size_t size = 0;
+    // Size of the resource in the pack file.
+    size_t stored_size = 0;
+    Compression compression = Compression::None;
 };
 
+/*
+ * Provides the resources stored in a .pack file.
+ * The pack file is memory mapped once when the provider is created, and streams read directly from the mapping,
+ *  so opening a resource does not need any file access.
+ * On Android the packs are assets that cannot be mapped. There all streams share a single file handle instead.
+ * Providers are never destroyed, so the mapping stays valid for all streams.
+ *
+ * Version 0 packs have a list of name, position and size entries, which is loaded into a hash map.
+ * Version 1 packs (see packs/pack_gen.py) start with a fixed size directory sorted on the hash of the names,
+ *  followed by a string table with the names. The directory is used as is, without building a map.
+ *  Entries can be LZ4 compressed, these are decompressed into memory when they are opened.
+ *  Entries are aligned to 4KB, so they start at a page boundary of the mapping.
+ */
 class PackResourceProvider : public ResourceProvider
 {
+    // Version 1 layout: version, file count and string table size, followed by the directory entries, each with
+    //  name hash, name offset, name length, compression, position, stored size and size.
+    static constexpr size_t directory_offset = 12;
+    static constexpr size_t directory_entry_size = 40;
+
     string filename;
+    int version = -1;
     std::unordered_map<string, PackResourceInfo> files;
+    std::vector<uint8_t> directory;
+    size_t entry_count = 0;
+
+#ifdef ANDROID
+    struct SDL_RWops* f = nullptr;
+    std::mutex file_mutex;
+#else
+    const uint8_t* data = nullptr;
+    size_t data_size = 0;
+#endif
+
+    bool open();
+    size_t getFileSize();
+    bool readAt(size_t position, void* buffer, size_t size);
+    bool loadIndexV0(int32_t file_count);
+    bool loadDirectoryV1(int32_t file_count, uint32_t string_table_size);
+    bool isValid(const PackResourceInfo& info);
+    PackResourceInfo getDirectoryEntry(size_t index);
+    bool findEntry(const string& name, PackResourceInfo& info);
 public:
     PackResourceProvider(string filename);
 
@@ -24,24 +74,29 @@ public:
     virtual std::vector<string> findResources(const string searchPattern) override;
 
     static void addPackResourcesForDirectory(const string directory);
+
+    friend class PackResourceStream;
 };
 
 class PackResourceStream : public ResourceStream
 {
-    struct SDL_RWops* f;
+    PackResourceProvider* provider;
     size_t position;
     size_t size;
-    size_t read_position;
+    size_t read_position = 0;
+    // Decompressed contents, empty if the resource is read directly from the pack.
+    std::vector<uint8_t> buffer;
 
-    PackResourceStream(string filename, PackResourceInfo info);
+    PackResourceStream(PackResourceProvider* provider, PackResourceInfo info);
 public:
-    virtual ~PackResourceStream();
-
     virtual size_t read(void* data, size_t size) override;
     virtual size_t seek(size_t position) override;
     virtual size_t tell() override;
     virtual size_t getSize() override;
 
+    // Direct access to the contents of the resource, without copying it. Returns nullptr if the pack is not memory mapped.
+    const uint8_t* getData();
+
     friend class PackResourceProvider;
 };
 
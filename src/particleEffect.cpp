@@ -4,10 +4,11 @@
 #include "particleEffect.h"
 #include "shaderManager.h"
 #include "textureManager.h"
-#include "tween.h"
 
 #include <SDL_assert.h>
 
+#include <algorithm>
+
 #include <glm/gtx/norm.hpp>
 #include <glm/gtc/type_ptr.hpp>
 
@@ -29,13 +30,20 @@ void ParticleEngine::render(const glm::mat4& projection, const glm::mat4& view)
 
 void ParticleEngine::update(float delta)
 {
-    // Update particles, move all freshly expired particles to the end.
-    // Update our first_expired entry.
-    first_expired = std::partition(std::begin(particles), first_expired, [delta](Particle& p)
-    {
-        p.life_time += delta;
-        return p.life_time <= p.max_life_time;
-    });
+    time += delta;
+
+    // Expired slots at the end are no longer drawn, expired slots in between are reused for new particles.
+    while(slot_count > 0 && expire_times[slot_count - 1] < time)
+        slot_count--;
+    free_slots.clear();
+    for(size_t n = slot_count; n > 0; n--)
+        if (expire_times[n - 1] < time)
+            free_slots.push_back(static_cast<uint32_t>(n - 1));
+
+    if (slot_count == 0)
+        time = 0.0f;
+    else if (time > time_rebase_interval)
+        rebaseTime();
 }
 
 void ParticleEngine::spawn(glm::vec3 position, glm::vec3 end_position, glm::vec3 color, glm::vec3 end_color, float size, float end_size, float life_time)
@@ -50,7 +58,6 @@ void ParticleEngine::spawn(glm::vec3 position, glm::vec3 end_position, glm::vec3
 }
 
 ParticleEngine::ParticleEngine()
-    :first_expired{ std::end(particles) }
 {
 }
 
@@ -59,6 +66,10 @@ void ParticleEngine::doRender(const glm::mat4& projection, const glm::mat4& view
 {
     if (!buffers[0])
         initialize();
+    if (slot_count == 0)
+        return;
+
+    uploadSlots();
 
     shader->bind();
 
@@ -69,76 +80,157 @@ void ParticleEngine::doRender(const glm::mat4& projection, const glm::mat4& view
     // - Matrices
     glUniformMatrix4fv(uniforms[as_index(Uniforms::Projection)], 1, GL_FALSE, glm::value_ptr(projection));
     glUniformMatrix4fv(uniforms[as_index(Uniforms::View)], 1, GL_FALSE, glm::value_ptr(view));
-    
+    glUniform1f(uniforms[as_index(Uniforms::Time)], time);
+
     {
-        gl::ScopedVertexAttribArray centers(attributes[as_index(Attributes::Center)]);
+        gl::ScopedVertexAttribArray start_centers(attributes[as_index(Attributes::StartCenter)]);
+        gl::ScopedVertexAttribArray end_centers(attributes[as_index(Attributes::EndCenter)]);
         gl::ScopedVertexAttribArray texcoords(attributes[as_index(Attributes::TexCoords)]);
-        gl::ScopedVertexAttribArray colors(attributes[as_index(Attributes::Color)]);
-        gl::ScopedVertexAttribArray sizes(attributes[as_index(Attributes::Size)]);
+        gl::ScopedVertexAttribArray start_colors(attributes[as_index(Attributes::StartColor)]);
+        gl::ScopedVertexAttribArray end_colors(attributes[as_index(Attributes::EndColor)]);
+        gl::ScopedVertexAttribArray params(attributes[as_index(Attributes::Params)]);
         gl::ScopedBufferBinding element_buffer(GL_ELEMENT_ARRAY_BUFFER, buffers[as_index(Buffers::Element)]);
-        gl::ScopedBufferBinding vertex_buffer(GL_ARRAY_BUFFER, buffers[as_index(Buffers::Vertex)]);
 
-        glVertexAttribPointer(centers.get(), 3, GL_FLOAT, GL_FALSE, sizeof(ParticleData), reinterpret_cast<const GLvoid *>(offsetof(ParticleData, position)));
-        glVertexAttribPointer(texcoords.get(), 2, GL_FLOAT, GL_FALSE, sizeof(glm::vec2), reinterpret_cast<const GLvoid*>(max_vertex_count * sizeof(ParticleData)));
-        glVertexAttribPointer(colors.get(), 3, GL_FLOAT, GL_FALSE, sizeof(ParticleData), reinterpret_cast<const GLvoid*>(offsetof(ParticleData, color)));
-        glVertexAttribPointer(sizes.get(), 1, GL_FLOAT, GL_FALSE, sizeof(ParticleData), reinterpret_cast<const GLvoid*>(offsetof(ParticleData, size)));
- 
-        // Process only non-expired
-        size_t live_particle_count = first_expired - std::begin(particles);
+        // Every draw uses the same quad corners.
+        glBindBuffer(GL_ARRAY_BUFFER, buffers[as_index(Buffers::TexCoords)]);
+        glVertexAttribPointer(texcoords.get(), 2, GL_FLOAT, GL_FALSE, sizeof(glm::vec2), nullptr);
 
-        for (size_t n = 0U; n < live_particle_count;)
+        for (size_t n = 0U; n < slot_count;)
         {
-            auto instance_count = std::min(live_particle_count - n, instances_per_draw);
+            auto instance_count = std::min(slot_count - n, instances_per_draw);
+            auto first_vertex = n * vertices_per_instance;
+
+            glBindBuffer(GL_ARRAY_BUFFER, buffers[as_index(Buffers::Positions)]);
+            glVertexAttribPointer(start_centers.get(), 3, GL_FLOAT, GL_FALSE, sizeof(VertexPosition), reinterpret_cast<const GLvoid*>(first_vertex * sizeof(VertexPosition) + offsetof(VertexPosition, start)));
+            glVertexAttribPointer(end_centers.get(), 3, GL_FLOAT, GL_FALSE, sizeof(VertexPosition), reinterpret_cast<const GLvoid*>(first_vertex * sizeof(VertexPosition) + offsetof(VertexPosition, end)));
+            glBindBuffer(GL_ARRAY_BUFFER, buffers[as_index(Buffers::Colors)]);
+            glVertexAttribPointer(start_colors.get(), 3, GL_FLOAT, GL_FALSE, sizeof(VertexColor), reinterpret_cast<const GLvoid*>(first_vertex * sizeof(VertexColor) + offsetof(VertexColor, start)));
+            glVertexAttribPointer(end_colors.get(), 3, GL_FLOAT, GL_FALSE, sizeof(VertexColor), reinterpret_cast<const GLvoid*>(first_vertex * sizeof(VertexColor) + offsetof(VertexColor, end)));
+            glBindBuffer(GL_ARRAY_BUFFER, buffers[as_index(Buffers::Params)]);
+            glVertexAttribPointer(params.get(), 4, GL_FLOAT, GL_FALSE, sizeof(VertexParams), reinterpret_cast<const GLvoid*>(first_vertex * sizeof(VertexParams)));
 
-            // setup the instances (individual particles)
-            for (auto instance = 0U; instance < instance_count; ++instance)
-            {
-                const auto& p = particles[n + instance];
-                auto position = Tween<glm::vec3>::easeOutQuad(p.life_time, 0, p.max_life_time, p.start.position, p.end.position);
-                auto color = Tween<glm::vec3>::easeOutQuad(p.life_time, 0, p.max_life_time, p.start.color, p.end.color);
-                auto size = Tween<float>::easeOutQuad(p.life_time, 0, p.max_life_time, p.start.size, p.end.size);
-
-                auto base_vertex = vertices_per_instance * instance;
-                for (auto v = 0U; v < vertices_per_instance; ++v)
-                {
-                    particles_renderdata[base_vertex + v].position = position;
-                    particles_renderdata[base_vertex + v].color = color;
-                    particles_renderdata[base_vertex + v].size = size;
-                }
-            }
-
-            // Send instances to shader.
-            glBufferSubData(GL_ARRAY_BUFFER, 0, instance_count * vertices_per_instance * sizeof(ParticleData), particles_renderdata.data());
-        
             // Draw our instances
             glDrawElements(GL_TRIANGLES, static_cast<GLsizei>(elements_per_instance * instance_count), GL_UNSIGNED_SHORT, nullptr);
-            
+
             n += instance_count;
         }
+        glBindBuffer(GL_ARRAY_BUFFER, GL_NONE);
     }
 }
 
 void ParticleEngine::doSpawn(glm::vec3 position, glm::vec3 end_position, glm::vec3 color, glm::vec3 end_color, float size, float end_size, float life_time)
 {
-    if (first_expired == std::end(particles))
+    uint32_t slot;
+    if (!free_slots.empty())
+    {
+        slot = free_slots.back();
+        free_slots.pop_back();
+    }
+    else
     {
-        // No expired particles - add more.
-        constexpr size_t batch_size = 64;
-        particles.resize(particles.size() + batch_size);
-        first_expired = std::end(particles) - batch_size;
+        if (slot_count == expire_times.size())
+        {
+            // No free slots - add more.
+            constexpr size_t batch_size = 64;
+            expire_times.resize(expire_times.size() + batch_size);
+            vertex_positions.resize(expire_times.size() * vertices_per_instance);
+            vertex_colors.resize(expire_times.size() * vertices_per_instance);
+            vertex_params.resize(expire_times.size() * vertices_per_instance);
+        }
+        slot = static_cast<uint32_t>(slot_count++);
     }
 
-    // Update particle at first_expired.
-    first_expired->start.position = position;
-    first_expired->end.position = end_position;
-    first_expired->start.color = color;
-    first_expired->end.color = end_color;
-    first_expired->start.size = size;
-    first_expired->end.size = end_size;
-    first_expired->life_time = 0.f;
-    first_expired->max_life_time = life_time;
-
-    ++first_expired;
+    expire_times[slot] = time + life_time;
+    auto base_vertex = slot * vertices_per_instance;
+    for (auto v = 0U; v < vertices_per_instance; ++v)
+    {
+        vertex_positions[base_vertex + v] = { position, end_position };
+        vertex_colors[base_vertex + v] = { color, end_color };
+        vertex_params[base_vertex + v] = { size, end_size, time, life_time };
+    }
+    // The list is only emptied when the particles are rendered. Without a 3D view (headless server) it would grow forever,
+    //  so once it holds as many entries as there are slots, switch to uploading everything.
+    if (all_dirty)
+        return;
+    if (dirty_slots.size() >= slot_count)
+    {
+        all_dirty = true;
+        dirty_slots.clear();
+        return;
+    }
+    dirty_slots.push_back(slot);
+}
+
+// Upload the vertices of the slots [begin, end) to the currently bound array buffer.
+template<typename T>
+static void uploadVertices(const std::vector<T>& vertices, size_t begin, size_t end)
+{
+    glBufferSubData(GL_ARRAY_BUFFER, begin * sizeof(T), (end - begin) * sizeof(T), vertices.data() + begin);
+}
+
+void ParticleEngine::uploadSlots()
+{
+    auto upload = [this](size_t begin, size_t end)
+    {
+        if (end <= begin)
+            return;
+        begin *= vertices_per_instance;
+        end *= vertices_per_instance;
+        glBindBuffer(GL_ARRAY_BUFFER, buffers[as_index(Buffers::Positions)]);
+        uploadVertices(vertex_positions, begin, end);
+        glBindBuffer(GL_ARRAY_BUFFER, buffers[as_index(Buffers::Colors)]);
+        uploadVertices(vertex_colors, begin, end);
+        glBindBuffer(GL_ARRAY_BUFFER, buffers[as_index(Buffers::Params)]);
+        uploadVertices(vertex_params, begin, end);
+    };
+
+    if (slot_count > buffer_capacity)
+    {
+        buffer_capacity = std::max(buffer_capacity * 2, slot_count);
+        auto vertex_count = buffer_capacity * vertices_per_instance;
+        glBindBuffer(GL_ARRAY_BUFFER, buffers[as_index(Buffers::Positions)]);
+        glBufferData(GL_ARRAY_BUFFER, vertex_count * sizeof(VertexPosition), nullptr, GL_DYNAMIC_DRAW);
+        glBindBuffer(GL_ARRAY_BUFFER, buffers[as_index(Buffers::Colors)]);
+        glBufferData(GL_ARRAY_BUFFER, vertex_count * sizeof(VertexColor), nullptr, GL_DYNAMIC_DRAW);
+        glBindBuffer(GL_ARRAY_BUFFER, buffers[as_index(Buffers::Params)]);
+        glBufferData(GL_ARRAY_BUFFER, vertex_count * sizeof(VertexParams), nullptr, GL_DYNAMIC_DRAW);
+        all_dirty = true;
+    }
+
+    if (all_dirty)
+    {
+        upload(0, slot_count);
+        all_dirty = false;
+    }
+    else if (!dirty_slots.empty())
+    {
+        // Merge nearby slots into ranges, uploading a few unchanged slots is cheaper than many small uploads.
+        std::sort(dirty_slots.begin(), dirty_slots.end());
+        size_t begin = dirty_slots.front();
+        size_t end = begin + 1;
+        for(auto slot : dirty_slots)
+        {
+            if (slot >= end + upload_merge_distance)
+            {
+                upload(begin, std::min(end, slot_count));
+                begin = slot;
+            }
+            end = std::max(end, size_t(slot) + 1);
+        }
+        upload(begin, std::min(end, slot_count));
+    }
+    dirty_slots.clear();
+    glBindBuffer(GL_ARRAY_BUFFER, GL_NONE);
+}
+
+void ParticleEngine::rebaseTime()
+{
+    for(size_t n = 0; n < slot_count; n++)
+        expire_times[n] -= time;
+    for(size_t n = 0; n < slot_count * vertices_per_instance; n++)
+        vertex_params[n].spawn_time -= time;
+    time = 0.0f;
+    all_dirty = true;
 }
 
 void ParticleEngine::initialize()
@@ -151,16 +243,18 @@ void ParticleEngine::initialize()
 
     uniforms[as_index(Uniforms::Projection)] = shader->getUniformLocation("projection");
     uniforms[as_index(Uniforms::View)] = shader->getUniformLocation("view");
+    uniforms[as_index(Uniforms::Time)] = shader->getUniformLocation("time");
 
-    attributes[as_index(Attributes::Center)] = shader->getAttributeLocation("center");
+    attributes[as_index(Attributes::StartCenter)] = shader->getAttributeLocation("start_center");
+    attributes[as_index(Attributes::EndCenter)] = shader->getAttributeLocation("end_center");
     attributes[as_index(Attributes::TexCoords)] = shader->getAttributeLocation("texcoords");
-    attributes[as_index(Attributes::Color)] = shader->getAttributeLocation("color");
-    attributes[as_index(Attributes::Size)] = shader->getAttributeLocation("size");
+    attributes[as_index(Attributes::StartColor)] = shader->getAttributeLocation("start_color");
+    attributes[as_index(Attributes::EndColor)] = shader->getAttributeLocation("end_color");
+    attributes[as_index(Attributes::Params)] = shader->getAttributeLocation("params");
 
     std::vector<uint16_t> elements(instances_per_draw * elements_per_instance);
 
     std::vector<glm::vec2> texcoords(max_vertex_count);
-    particles_renderdata.resize(max_vertex_count);
 
     // Hitting this means needing to lower the number of instances / vertices per instance.
     SDL_assert((texcoords.size() - 1) <= std::numeric_limits<uint16_t>::max());
@@ -186,17 +280,10 @@ void ParticleEngine::initialize()
         texcoords[base_vertex + 3] = { 0.f, 0.f };
     }
 
-    // Hand off to the GPU.
+    // Hand off to the GPU. The particle buffers are created when the first particles are uploaded.
     gl::ScopedBufferBinding element_buffer(GL_ELEMENT_ARRAY_BUFFER, buffers[as_index(Buffers::Element)]);
-    gl::ScopedBufferBinding vertex_buffer(GL_ARRAY_BUFFER, buffers[as_index(Buffers::Vertex)]);
+    gl::ScopedBufferBinding texcoords_buffer(GL_ARRAY_BUFFER, buffers[as_index(Buffers::TexCoords)]);
 
     glBufferData(GL_ELEMENT_ARRAY_BUFFER, elements.size() * sizeof(uint16_t), elements.data(), GL_STATIC_DRAW);
-    glBufferData(GL_ARRAY_BUFFER, max_vertex_count * (sizeof(ParticleData) + sizeof(glm::vec2)), nullptr, GL_DYNAMIC_DRAW);
-    {
-        // Ensure zero-initialization of the particle data.
-        glBufferSubData(GL_ARRAY_BUFFER, 0, particles_renderdata.size() * sizeof(ParticleData), particles_renderdata.data());
-
-        // Upload texcoords once.
-        glBufferSubData(GL_ARRAY_BUFFER, particles_renderdata.size() * sizeof(ParticleData), texcoords.size() * sizeof(glm::vec2), texcoords.data());
-    }
+    glBufferData(GL_ARRAY_BUFFER, texcoords.size() * sizeof(glm::vec2), texcoords.data(), GL_STATIC_DRAW);
 }
@@ -8,22 +8,16 @@
 
 #include <glm/vec3.hpp>
 #include <glm/mat4x4.hpp>
-
-struct ParticleData
-{
-    glm::vec3 position{};
-    glm::vec3 color{};
-    float size{};
-};
-class Particle
-{
-public:
-    ParticleData start;
-    ParticleData end;
-    float life_time;
-    float max_life_time;
-};
-
+#include <vector>
+#include <array>
+
+/*
+ * Particles are not updated on the CPU. When a particle is spawned its start and end state, spawn time and life time
+ *  are written to a slot in the vertex buffers once, and the vertex shader interpolates them using the current time.
+ * The vertex data is stored as separate arrays per attribute, with the per particle data repeated for each corner of the quad,
+ *  as ES2 has no instancing. Slots of expired particles collapse to nothing in the shader and are reused by new particles,
+ *  so particles never move between slots and only changed slots need to be uploaded.
+ */
 class ParticleEngine : public Updatable
 {
     static ParticleEngine* particleEngine;
@@ -32,11 +26,16 @@ class ParticleEngine : public Updatable
     static constexpr size_t elements_per_instance = 6; // ... made of two triangles (ES2 has no support for GL_QUADS)
     static constexpr size_t instances_per_draw = (std::numeric_limits<uint16_t>::max() + 1) / vertices_per_instance; // Number of particles that a single draw can handle.
     static constexpr size_t max_vertex_count = instances_per_draw * vertices_per_instance; // Maximum number of vertices per draw call.
+    // Dirty slots that are closer together than this are uploaded in a single call.
+    static constexpr size_t upload_merge_distance = 64;
+    // The time is reset once in a while, so it keeps enough float precision in the shader.
+    static constexpr float time_rebase_interval = 3600.0f;
 
     enum class Uniforms : uint8_t
     {
         Projection = 0,
         View,
+        Time,
 
         Count
     };
@@ -44,21 +43,45 @@ class ParticleEngine : public Updatable
     enum class Buffers : uint8_t
     {
         Element = 0,
-        Vertex,
+        TexCoords,
+        Positions,
+        Colors,
+        Params,
 
         Count
     };
 
     enum class Attributes : uint8_t
     {
-        Center = 0,
+        StartCenter = 0,
+        EndCenter,
         TexCoords,
-        Color,
-        Size,
+        StartColor,
+        EndColor,
+        Params,
 
         Count
     };
 
+    // Per vertex data, the vertices of a particle are at [slot * vertices_per_instance, (slot + 1) * vertices_per_instance).
+    struct VertexPosition
+    {
+        glm::vec3 start;
+        glm::vec3 end;
+    };
+    struct VertexColor
+    {
+        glm::vec3 start;
+        glm::vec3 end;
+    };
+    struct VertexParams
+    {
+        float start_size;
+        float end_size;
+        float spawn_time;
+        float life_time;
+    };
+
 public:
     static void render(const glm::mat4& projection, const glm::mat4& view);
     virtual void update(float delta) override;
@@ -70,15 +93,30 @@ private:
     void doRender(const glm::mat4& projection, const glm::mat4& view);
     void doSpawn(glm::vec3 position, glm::vec3 end_position, glm::vec3 color, glm::vec3 end_color, float size, float end_size, float life_time);
     void initialize();
+    void uploadSlots();
+    void rebaseTime();
 
     std::array<uint32_t, static_cast<size_t>(Uniforms::Count)> uniforms;
     std::array<uint32_t, static_cast<size_t>(Attributes::Count)> attributes{};
     gl::Buffers<static_cast<size_t>(Buffers::Count)> buffers{ gl::Unitialized{} };
 
-    std::vector<Particle> particles;
-    std::vector<Particle>::iterator first_expired;
-    
-    std::vector<ParticleData> particles_renderdata;
+    float time = 0.0f;
+    // Number of slots in use, including expired slots that are not at the end.
+    size_t slot_count = 0;
+    // Number of slots the vertex buffers have room for.
+    size_t buffer_capacity = 0;
+    // Time at which the particle in each slot expires.
+    std::vector<float> expire_times;
+    // Expired slots below slot_count, highest first, so new particles fill the lowest slots.
+    std::vector<uint32_t> free_slots;
+    // Slots changed since the last upload, not kept while all_dirty is set.
+    std::vector<uint32_t> dirty_slots;
+    // Set when all slots need to be uploaded, after the buffers grew or the time was reset.
+    bool all_dirty = false;
+
+    std::vector<VertexPosition> vertex_positions;
+    std::vector<VertexColor> vertex_colors;
+    std::vector<VertexParams> vertex_params;
     sp::Shader* shader = nullptr;
 };
 
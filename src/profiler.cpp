@@ -0,0 +1,187 @@
+#include "profiler.h"
+
+#include <algorithm>
+#include <set>
+#ifdef __GNUC__
+#include <cxxabi.h>
+#include <cstdlib>
+#endif
+
+
+const std::vector<float> Profiler::histogram_limits{0.1f, 0.25f, 0.5f, 1.0f, 2.0f, 4.0f, 8.0f, 16.0f};
+
+Profiler* Profiler::instance = nullptr;
+bool Profiler::enabled = false;
+int Profiler::depth = 0;
+Profiler::clock::time_point Profiler::epoch = Profiler::clock::now();
+Profiler::clock::time_point Profiler::frame_start;
+std::vector<Profiler::Event> Profiler::frame_events;
+std::unordered_map<const char*, float> Profiler::frame_totals;
+std::mutex Profiler::mutex;
+std::unordered_map<const char*, Profiler::Section> Profiler::sections;
+size_t Profiler::frame_index = 0;
+std::deque<std::vector<Profiler::Event>> Profiler::trace;
+
+static const char* frame_name = "Frame";
+
+
+Profiler::Profiler()
+{
+}
+
+void Profiler::setEnabled(bool enable)
+{
+    if (enable && !instance)
+        instance = new Profiler();
+    if (enable && !enabled)
+    {
+        frame_start = clock::now();
+        frame_events.clear();
+    }
+    enabled = enable;
+}
+
+const char* Profiler::intern(const string& name)
+{
+    static std::set<std::string> names;
+    return names.insert(name).first->c_str();
+}
+
+string Profiler::typeName(const std::type_info& type)
+{
+    string name = type.name();
+#ifdef __GNUC__
+    int status = 0;
+    char* demangled = abi::__cxa_demangle(type.name(), nullptr, nullptr, &status);
+    if (demangled)
+    {
+        if (status == 0)
+            name = demangled;
+        free(demangled);
+    }
+#endif
+    // MSVC names include the kind of type.
+    if (name.startswith("class "))
+        name = name.substr(6);
+    else if (name.startswith("struct "))
+        name = name.substr(7);
+    return name;
+}
+
+void Profiler::record(const char* name, clock::time_point start, clock::time_point end, int depth)
+{
+    auto start_us = toMicroseconds(start);
+    auto end_us = toMicroseconds(end);
+    frame_totals[name] += std::chrono::duration<float, std::milli>(end - start).count();
+
+    // Merge scopes that closely follow each other, so drawing many objects of the same kind becomes a single trace event.
+    if (!frame_events.empty())
+    {
+        auto& last = frame_events.back();
+        if (last.name == name && last.depth == depth && last.start + last.duration + merge_gap >= start_us)
+        {
+            last.duration = end_us - last.start;
+            return;
+        }
+    }
+    if (frame_events.size() < max_events_per_frame)
+        frame_events.push_back({name, start_us, end_us - start_us, depth});
+}
+
+void Profiler::update(float delta)
+{
+    if (!enabled)
+        return;
+
+    auto now = clock::now();
+    frame_totals[frame_name] = std::chrono::duration<float, std::milli>(now - frame_start).count();
+    frame_events.push_back({frame_name, toMicroseconds(frame_start), toMicroseconds(now) - toMicroseconds(frame_start), 0});
+    frame_start = now;
+
+    std::lock_guard<std::mutex> lock(mutex);
+    auto history_index = frame_index % history_frames;
+    for(auto& it : sections)
+        it.second.history[history_index] = 0.0f;
+    for(auto& [name, total] : frame_totals)
+    {
+        sections[name].history[history_index] = total;
+        total = 0.0f;
+    }
+    frame_index++;
+
+    trace.emplace_back(std::move(frame_events));
+    frame_events.clear();
+    while(trace.size() > trace_frames)
+        trace.pop_front();
+}
+
+std::vector<Profiler::SectionStats> Profiler::getStats()
+{
+    std::vector<SectionStats> result;
+    std::lock_guard<std::mutex> lock(mutex);
+    auto frame_count = std::min(frame_index, history_frames);
+    if (frame_count == 0)
+        return result;
+    auto last_frame = (frame_index - 1) % history_frames;
+    for(auto& [name, section] : sections)
+    {
+        SectionStats stats{name, section.history[last_frame], 0.0f, 0.0f, std::vector<int>(histogram_limits.size() + 1, 0)};
+        for(size_t n=0; n<frame_count; n++)
+        {
+            auto value = section.history[n];
+            stats.average += value;
+            stats.max = std::max(stats.max, value);
+            auto bucket = std::upper_bound(histogram_limits.begin(), histogram_limits.end(), value) - histogram_limits.begin();
+            stats.histogram[bucket]++;
+        }
+        stats.average /= frame_count;
+        result.push_back(std::move(stats));
+    }
+    std::sort(result.begin(), result.end(), [](const SectionStats& a, const SectionStats& b) { return a.average > b.average; });
+    return result;
+}
+
+static string jsonString(const string& str)
+{
+    return "\"" + str.replace("\\", "\\\\").replace("\"", "\\\"") + "\"";
+}
+
+string Profiler::getStatsJSON()
+{
+    string json = "{\"enabled\": " + string(enabled ? "true" : "false") + ", \"histogram_limits\": [";
+    for(size_t n=0; n<histogram_limits.size(); n++)
+        json += (n ? ", " : "") + string(histogram_limits[n], 2);
+    json += "], \"sections\": [";
+    bool first = true;
+    for(auto& stats : getStats())
+    {
+        if (!first)
+            json += ", ";
+        first = false;
+        json += "{\"name\": " + jsonString(stats.name) + ", \"last\": " + string(stats.last, 3) + ", \"average\": " + string(stats.average, 3) + ", \"max\": " + string(stats.max, 3) + ", \"histogram\": [";
+        for(size_t n=0; n<stats.histogram.size(); n++)
+            json += (n ? ", " : "") + string(stats.histogram[n]);
+        json += "]}";
+    }
+    json += "]}";
+    return json;
+}
+
+string Profiler::getChromeTraceJSON()
+{
+    string json = "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [";
+    bool first = true;
+    std::lock_guard<std::mutex> lock(mutex);
+    for(auto& frame : trace)
+    {
+        for(auto& event : frame)
+        {
+            if (!first)
+                json += ",\n";
+            first = false;
+            json += "{\"name\": " + jsonString(event.name) + ", \"ph\": \"X\", \"pid\": 1, \"tid\": 1, \"ts\": " + std::to_string(event.start) + ", \"dur\": " + std::to_string(event.duration) + "}";
+        }
+    }
+    json += "]}";
+    return json;
+}
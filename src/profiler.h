@@ -0,0 +1,142 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include "Updatable.h"
+#include "stringImproved.h"
+
+#include <chrono>
+#include <vector>
+#include <deque>
+#include <unordered_map>
+#include <mutex>
+#include <typeinfo>
+
+/*
+ * Frame profiler for the main thread.
+ * Code to measure is wrapped in a Profiler::Scope. Every system update, 3D and radar render handler and
+ *  replication update already is, see ProfiledSystem, RenderSystem, RadarRenderSystem and BASIC_REPLICATION_IMPL.
+ * For every section the total time per frame is kept for the last few seconds, from which the average,
+ *  maximum and a histogram are calculated. The individual scopes of the last few frames are kept as well,
+ *  and can be exported in the Chrome trace format (chrome://tracing, or https://ui.perfetto.dev).
+ * The results are shown by the DebugRenderer timing overlay and served by the HTTP server on
+ *  /profiler.json and /profiler_trace.json.
+ * Profiling is off until it is enabled, a disabled scope only checks a flag.
+ */
+class Profiler : public Updatable
+{
+    using clock = std::chrono::steady_clock;
+public:
+    class Scope
+    {
+    public:
+        // The name is not copied, it has to be a literal or a name returned by intern.
+        explicit Scope(const char* name)
+        : name(enabled ? name : nullptr)
+        {
+            if (this->name)
+            {
+                start = clock::now();
+                depth++;
+            }
+        }
+        ~Scope()
+        {
+            if (name)
+            {
+                depth--;
+                record(name, start, clock::now(), depth);
+            }
+        }
+
+        Scope(const Scope&) = delete;
+        Scope& operator=(const Scope&) = delete;
+    private:
+        const char* name;
+        clock::time_point start;
+    };
+
+    struct SectionStats
+    {
+        string name;
+        // Time spend in the section per frame, in milliseconds.
+        float last;
+        float average;
+        float max;
+        // Number of frames per bucket, see histogram_limits.
+        std::vector<int> histogram;
+    };
+    // Upper limits of the histogram buckets in milliseconds, the last bucket has no upper limit.
+    static const std::vector<float> histogram_limits;
+
+    static void setEnabled(bool enabled);
+    static bool isEnabled() { return enabled; }
+
+    // Stable copy of a name, for names that are build at runtime.
+    static const char* intern(const string& name);
+    // Readable name of a type, for naming sections after the class that is measured.
+    static string typeName(const std::type_info& type);
+
+    // Stats of all sections, sorted on average time, highest first.
+    static std::vector<SectionStats> getStats();
+    static string getStatsJSON();
+    // The recorded scopes of the last frames, in the Chrome trace event format.
+    static string getChromeTraceJSON();
+
+    virtual void update(float delta) override;
+
+private:
+    static constexpr size_t history_frames = 300;
+    static constexpr size_t trace_frames = 120;
+    // Limit the number of scopes kept per frame, so per object scopes cannot use up all memory.
+    static constexpr size_t max_events_per_frame = 10000;
+    // Scopes of the same section less than this many microseconds apart are merged into a single trace event.
+    static constexpr int64_t merge_gap = 20;
+
+    struct Event
+    {
+        const char* name;
+        int64_t start; // In microseconds since the profiler was created.
+        int64_t duration;
+        int depth;
+    };
+    struct Section
+    {
+        float history[history_frames]{};
+    };
+
+    Profiler();
+    static void record(const char* name, clock::time_point start, clock::time_point end, int depth);
+    static int64_t toMicroseconds(clock::time_point time) { return std::chrono::duration_cast<std::chrono::microseconds>(time - epoch).count(); }
+
+    static Profiler* instance;
+    static bool enabled;
+    static int depth;
+    static clock::time_point epoch;
+    static clock::time_point frame_start;
+
+    // Only touched from the main thread.
+    static std::vector<Event> frame_events;
+    static std::unordered_map<const char*, float> frame_totals;
+
+    // Guards the data below, which is also read by the HTTP server.
+    static std::mutex mutex;
+    static std::unordered_map<const char*, Section> sections;
+    static size_t frame_index;
+    static std::deque<std::vector<Event>> trace;
+};
+
+// Wraps a system so its update is measured. Registered with engine->registerSystem<ProfiledSystem<T>>()
+//  after setting the name, see REGISTER_SYSTEM in init/ecs.cpp.
+template<typename T> class ProfiledSystem : public T
+{
+public:
+    static inline const char* profile_name = "System";
+
+    void update(float delta) override
+    {
+        Profiler::Scope scope(profile_name);
+        T::update(delta);
+    }
+};
+
+#endif//PROFILER_H
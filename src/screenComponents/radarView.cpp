@@ -17,6 +17,7 @@
 #include "systems/missilesystem.h"
 #include "systems/radarblock.h"
 #include "systems/radar.h"
+#include "systems/radarvisibility.h"
 #include "main.h"
 #include "gameGlobalInfo.h"
 #include "tween.h"
@@ -588,12 +589,12 @@ void GuiRadarView::drawObjects(sp::RenderTarget& renderer)
 {
     float scale = std::min(rect.size.x, rect.size.y) / 2.0f / distance;
 
-    sp::Bitset visible_objects;
+    // The fog of war sets are shared with the other radar views, and only computed once per frame.
+    const sp::Bitset* visible_objects = nullptr;
     switch(fog_style)
     {
     case NoFogOfWar:
-        for(auto [entity, transform] : sp::ecs::Query<sp::Transform>())
-            visible_objects.set(entity.getIndex());
+        // Everything is visible, no need to build the set.
         break;
     case FriendlysShortRangeFogOfWar:
         // Reveal objects if they are within short-range radar range (or 5U) of
@@ -604,61 +605,14 @@ void GuiRadarView::drawObjects(sp::RenderTarget& renderer)
         {
             return;
         }
-
-        // For each SpaceObject on the map...
-        for(auto [entity, transform] : sp::ecs::Query<sp::Transform>())
-        {
-            // If the object can't hide in a nebula, it's considered visible.
-            if (entity.hasComponent<NeverRadarBlocked>()) {
-                visible_objects.set(entity.getIndex());
-                continue;
-            }
-
-            // Consider the object only if it is:
-            // - Any ShipTemplateBasedObject (ship or station)
-            // - A SpaceObject belonging to a friendly faction
-            // - The player's ship
-            // - A scan probe owned by the player's ship
-            // This check is duplicated in RelayScreen::onDraw.
-            if (!entity.hasComponent<ShareShortRangeRadar>())
-                continue;
-            if (Faction::getRelation(my_spaceship, entity) != FactionRelation::Friendly)
-                continue;
-
-            // Set the radius to reveal as getShortRangeRadarRange() if the
-            // object's a ShipTemplateBasedObject. Otherwise, default to 5U.
-            float r = entity.getComponent<LongRangeRadar>() ? entity.getComponent<LongRangeRadar>()->short_range : 5000.0f;
-
-            // Query for objects within short-range radar/5U of this object.
-            auto position = transform.getPosition();
-
-            // For each of those objects, check if it is at least partially
-            // inside the revealed radius. If so, reveal the object on the map.
-            for(auto entity2 : sp::CollisionSystem::queryArea(position - glm::vec2(r, r), position + glm::vec2(r, r)))
-            {
-                //TODO: This isn't great, as not everything will collision attached...
-                auto trace = entity2.getComponent<RadarTrace>();
-                float r2 = r + (trace ? trace->radius : 300.0f);
-                if (auto t2 = entity2.getComponent<sp::Transform>()) {
-                    if (glm::length2(transform.getPosition() - t2->getPosition()) < r2*r2)
-                        visible_objects.set(entity2.getIndex());
-                }
-            }
-        }
-
+        visible_objects = &RadarVisibilitySystem::getFriendlyShortRangeVisible(my_spaceship);
         break;
     case NebulaFogOfWar:
-        if (auto transform = my_spaceship.getComponent<sp::Transform>())
+        if (!my_spaceship)
         {
-            auto lrr = my_spaceship.getComponent<LongRangeRadar>();
-            auto short_range = lrr ? lrr->short_range : 5000.0f;
-            for(auto [entity, t] : sp::ecs::Query<sp::Transform>())
-            {
-                if (RadarBlockSystem::isRadarBlockedFrom(transform->getPosition(), entity, short_range))
-                    continue;
-                visible_objects.set(entity.getIndex());
-            }
+            return;
         }
+        visible_objects = &RadarVisibilitySystem::getNebulaVisible(my_spaceship);
         break;
     }
 
@@ -672,7 +626,9 @@ void GuiRadarView::drawObjects(sp::RenderTarget& renderer)
     glm::vec2 radar_screen_center = rect.center();
 
     glStencilFunc(GL_EQUAL, as_mask(RadarStencil::RadarBounds), as_mask(RadarStencil::RadarBounds));
-    RadarRenderSystem::render(renderer, radar_screen_center, scale, view_position, view_rotation, flags, visible_objects);
+    // Half the diagonal of the view, so the corners are covered at any view rotation.
+    float view_radius = glm::length(rect.size) / 2.0f / scale;
+    RadarRenderSystem::render(renderer, radar_screen_center, scale, view_position, view_rotation, view_radius, flags, visible_objects);
 }
 
 void GuiRadarView::drawObjectsGM(sp::RenderTarget& renderer)
@@ -31,6 +31,10 @@ void GuiRotatingModelView::onDraw(sp::RenderTarget& renderer)
 
     auto mrc = entity.getComponent<MeshRenderComponent>();
     if (!mrc) return;
+    // Nothing to show until the mesh is loaded, as the camera distance depends on its size.
+    Mesh::uploadLoaded();
+    auto mesh = mrc->getMesh();
+    if (!mesh || !mesh->isReady()) return;
 
     renderer.finish();
 
@@ -50,7 +54,7 @@ void GuiRotatingModelView::onDraw(sp::RenderTarget& renderer)
     glFrontFace(GL_CCW);
 
 
-    auto mesh_radius = mrc->getMesh()->greatest_distance_from_center * mrc->scale;
+    auto mesh_radius = mesh->greatest_distance_from_center * mrc->scale;
     float mesh_diameter = mesh_radius * 2.f;
     float near_clip_boundary = 1.f;
 
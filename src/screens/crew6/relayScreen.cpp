@@ -10,6 +10,7 @@
 #include "components/scanning.h"
 #include "components/radar.h"
 #include "components/name.h"
+#include "systems/radarvisibility.h"
 
 #include "screenComponents/radarView.h"
 #include "screenComponents/openCommsButton.h"
@@ -231,27 +232,8 @@ void RelayScreen::onDraw(sp::RenderTarget& renderer)
         auto target = targets.get();
         bool near_friendly = false;
 
-        // For each SpaceObject on the map...
-        if (auto target_transform = target.getComponent<sp::Transform>()) {
-            for(auto [entity, ssrr, transform] : sp::ecs::Query<ShareShortRangeRadar, sp::Transform>())
-            {
-                if (Faction::getRelation(my_spaceship, entity) != FactionRelation::Friendly)
-                    continue;
-
-                // Set the targetable radius to getShortRangeRadarRange() if the
-                // object's a ShipTemplateBasedObject. Otherwise, default to 5U.
-                float r = entity.getComponent<LongRangeRadar>() ? entity.getComponent<LongRangeRadar>()->short_range : 5000.0f;
-
-                // If the target is within the short-range radar range/5U of the
-                // object, consider it near a friendly object.
-                
-                if (glm::length2(transform.getPosition() - target_transform->getPosition()) < r * r)
-                {
-                    near_friendly = true;
-                    break;
-                }
-            }
-        }
+        if (auto target_transform = target.getComponent<sp::Transform>())
+            near_friendly = RadarVisibilitySystem::isInFriendlyShortRange(my_spaceship, target_transform->getPosition());
 
         if (!near_friendly)
         {
@@ -269,7 +251,7 @@ void RelayScreen::onDraw(sp::RenderTarget& renderer)
         if (auto cs = target.getComponent<CallSign>())
             info_callsign->setValue(cs->callsign);
 
-        auto faction = Faction::getInfo(target);
+        auto& faction = Faction::getInfo(target);
         auto scanstate = target.getComponent<ScanState>();
         if (!scanstate || scanstate->getStateFor(my_spaceship) >= ScanState::State::SimpleScan)
             info_faction->setValue(faction.locale_name);
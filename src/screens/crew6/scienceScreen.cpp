@@ -387,7 +387,7 @@ void ScienceScreen::onDraw(sp::RenderTarget& renderer)
         // hull integrity, and database reference button.
         if (scanstate >= ScanState::State::SimpleScan)
         {
-            auto faction = Faction::getInfo(target);
+            auto& faction = Faction::getInfo(target);
             info_faction->setValue(faction.locale_name);
             if (auto tn = target.getComponent<TypeName>())
                 info_type->setValue(tn->localized);
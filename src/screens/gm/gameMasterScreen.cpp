@@ -2,6 +2,7 @@
 #include "i18n.h"
 #include "main.h"
 #include "gameGlobalInfo.h"
+#include "scriptProfiler.h"
 #include "objectCreationView.h"
 #include "globalMessageEntryView.h"
 #include "tweak.h"
@@ -174,6 +175,7 @@ GameMasterScreen::GameMasterScreen(RenderLayer* render_layer)
             if (n == index)
             {
                 auto cb = callback.callback;
+                ScriptProfiler::Scope scope("GM function");
                 cb.call<void>();
                 return;
             }
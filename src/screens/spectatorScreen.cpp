@@ -2,10 +2,19 @@
 #include "main.h"
 #include "gameGlobalInfo.h"
 #include "multiplayer_server.h"
+#include "i18n.h"
+#include "gameReplay.h"
+#include "epsilonServer.h"
+#include "menus/mainMenus.h"
 
 #include "screenComponents/indicatorOverlays.h"
 #include "screenComponents/radarView.h"
 
+#include "gui/gui2_slider.h"
+#include "gui/gui2_selector.h"
+#include "gui/gui2_togglebutton.h"
+#include "gui/gui2_label.h"
+
 SpectatorScreen::SpectatorScreen(RenderLayer* render_layer)
 : GuiCanvas(render_layer)
 {
@@ -18,11 +27,60 @@ SpectatorScreen::SpectatorScreen(RenderLayer* render_layer)
         [this](glm::vec2 position) { this->onMouseUp(position); }
     );
 
-    new GuiIndicatorOverlays(this);
+    // The server stays paused during a replay, so the pause overlay and its unpause button would only get in the way.
+    //  Unpausing would run the simulation on the replayed entities.
+    if (!game_replay)
+        new GuiIndicatorOverlays(this);
+
+    // Playback controls when viewing a recorded game state log.
+    if (game_replay)
+    {
+        replay_controls = new GuiElement(this, "REPLAY_CONTROLS");
+        replay_controls->setPosition(0, -20, sp::Alignment::BottomCenter)->setSize(1000, 50);
+
+        replay_pause = new GuiToggleButton(replay_controls, "REPLAY_PAUSE", tr("replay", "Pause"), [](bool value) {
+            if (game_replay)
+                game_replay->setPaused(value);
+        });
+        replay_pause->setPosition(0, 0, sp::Alignment::TopLeft)->setSize(150, 50);
+
+        replay_speed = new GuiSelector(replay_controls, "REPLAY_SPEED", [](int index, string value) {
+            if (game_replay)
+                game_replay->setSpeed(value.toFloat());
+        });
+        for(float speed = 1.0f; speed <= GameReplay::max_speed; speed *= 2.0f)
+            replay_speed->addEntry(string(int(speed)) + "x", string(speed));
+        replay_speed->setSelectionIndex(0)->setPosition(150, 0, sp::Alignment::TopLeft)->setSize(150, 50);
+
+        replay_position = new GuiSlider(replay_controls, "REPLAY_POSITION", 0.0f, game_replay->getDuration(), 0.0f, [](float value) {
+            if (game_replay)
+                game_replay->seek(value);
+        });
+        replay_position->setPosition(300, 0, sp::Alignment::TopLeft)->setSize(550, 50);
+
+        replay_time = new GuiLabel(replay_controls, "REPLAY_TIME", "", 30);
+        replay_time->setPosition(850, 0, sp::Alignment::TopLeft)->setSize(150, 50);
+    }
 }
 
 void SpectatorScreen::update(float delta)
 {
+    if (replay_controls)
+    {
+        if (game_replay)
+        {
+            int seconds = int(game_replay->getTime());
+            char buf[16];
+            std::snprintf(buf, sizeof(buf), "%02d:%02d:%02d", seconds / 3600, (seconds / 60) % 60, seconds % 60);
+            replay_time->setText(buf);
+            replay_position->setValue(game_replay->getTime());
+        }
+        else
+        {
+            replay_controls->hide();
+        }
+    }
+
     float mouse_wheel_delta = keys.zoom_in.getValue() - keys.zoom_out.getValue();
     if (mouse_wheel_delta != 0.0f)
     {
@@ -41,7 +99,17 @@ void SpectatorScreen::update(float delta)
     if (keys.escape.getDown())
     {
         destroy();
-        returnToShipSelection(getRenderLayer());
+        if (game_replay)
+        {
+            // The replay has no scenario to return to. returnToMainMenu would open the replay again, as the replay preference is still set.
+            game_replay->destroy();
+            disconnectFromServer();
+            new MainMenu();
+        }
+        else
+        {
+            returnToShipSelection(getRenderLayer());
+        }
     }
     if (keys.pause.getDown())
     {
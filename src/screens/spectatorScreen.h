@@ -8,11 +8,21 @@
 
 
 class GuiRadarView;
+class GuiSlider;
+class GuiSelector;
+class GuiToggleButton;
+class GuiLabel;
 class SpectatorScreen : public GuiCanvas, public Updatable
 {
 private:
     GuiRadarView* main_radar;
 
+    GuiElement* replay_controls = nullptr;
+    GuiToggleButton* replay_pause = nullptr;
+    GuiSelector* replay_speed = nullptr;
+    GuiSlider* replay_position = nullptr;
+    GuiLabel* replay_time = nullptr;
+
     glm::vec2 drag_start_position{};
     glm::vec2 drag_previous_position{};
 public:
@@ -4,10 +4,12 @@
 #include "preferenceManager.h"
 #include "script.h"
 #include "resources.h"
+#include "mesh.h"
 #include "random.h"
 #include "config.h"
 #include "script/vector.h"
 #include "menus/luaConsole.h"
+#include "scriptProfiler.h"
 #include "systems/comms.h"
 #include "ecs/query.h"
 #include "components/collision.h"
@@ -38,7 +40,146 @@
 #include "systems/selfdestruct.h"
 #include "systems/radarblock.h"
 #include "math/centerOfMass.h"
+#include <cstdio>
+#include <cstring>
+#include <vector>
+#ifndef ANDROID
+#include <filesystem>
+#endif
+
+
+// Compiled scripts are kept in the cache directory, so unchanged scripts do not need to be parsed again.
+//  A cache file is named after the hash of the script name, and only used if the hash and size of the source match.
+//  Lua does not verify bytecode, so the bytecode is hashed as well, and a damaged cache file is never loaded.
+static string script_cache_path;
+// Increase this when the layout of the cache files changes.
+static constexpr uint32_t script_cache_version = 2;
+struct ScriptCacheHeader
+{
+    char magic[4];
+    uint32_t version;
+    uint64_t source_hash;
+    uint64_t source_size;
+    uint64_t bytecode_size;
+    uint64_t bytecode_hash;
+};
+
+// FNV-1a, 64 bit.
+static uint64_t hashScriptData(const void* data, size_t size)
+{
+    uint64_t hash = 14695981039346656037ull;
+    auto ptr = static_cast<const uint8_t*>(data);
+    for(size_t n=0; n<size; n++)
+    {
+        hash ^= ptr[n];
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+void setScriptCachePath(const string& path)
+{
+#ifndef ANDROID
+    std::error_code error_code;
+    std::filesystem::create_directories(path.c_str(), error_code);
+    if (error_code)
+    {
+        LOG(WARNING) << "Failed to create script cache directory " << path << ": " << error_code.message();
+        return;
+    }
+    script_cache_path = path;
+#endif
+}
+
+static bool loadScriptCache(const string& cache_file, uint64_t source_hash, uint64_t source_size, std::vector<char>& bytecode)
+{
+    FILE* f = fopen(cache_file.c_str(), "rb");
+    if (!f)
+        return false;
+    long file_size = -1;
+    if (fseek(f, 0, SEEK_END) == 0)
+        file_size = ftell(f);
+    ScriptCacheHeader header;
+    bool ok = fseek(f, 0, SEEK_SET) == 0 && fread(&header, sizeof(header), 1, f) == 1;
+    ok = ok && memcmp(header.magic, "EELC", 4) == 0 && header.version == script_cache_version;
+    ok = ok && header.source_hash == source_hash && header.source_size == source_size && header.bytecode_size < 0x10000000;
+    ok = ok && file_size >= 0 && uint64_t(file_size) == sizeof(header) + header.bytecode_size;
+    if (ok)
+    {
+        bytecode.resize(header.bytecode_size);
+        ok = fread(bytecode.data(), 1, bytecode.size(), f) == bytecode.size();
+        ok = ok && hashScriptData(bytecode.data(), bytecode.size()) == header.bytecode_hash;
+    }
+    fclose(f);
+    return ok;
+}
 
+static int writeBytecode(lua_State* L, const void* data, size_t size, void* user)
+{
+    auto bytecode = static_cast<std::vector<char>*>(user);
+    bytecode->insert(bytecode->end(), static_cast<const char*>(data), static_cast<const char*>(data) + size);
+    return 0;
+}
+
+// Expects the compiled chunk on top of the stack.
+static void saveScriptCache(lua_State* L, const string& cache_file, uint64_t source_hash, uint64_t source_size)
+{
+    std::vector<char> bytecode;
+    // Keep the debug information, so errors still report the line numbers.
+    if (lua_dump(L, writeBytecode, &bytecode, 0) != 0)
+        return;
+    ScriptCacheHeader header{};
+    memcpy(header.magic, "EELC", 4);
+    header.version = script_cache_version;
+    header.source_hash = source_hash;
+    header.source_size = source_size;
+    header.bytecode_size = bytecode.size();
+    header.bytecode_hash = hashScriptData(bytecode.data(), bytecode.size());
+
+    // Write to a temporary file first, so an interrupted write never leaves a cache file that looks valid.
+    string tmp_file = cache_file + ".tmp";
+    FILE* f = fopen(tmp_file.c_str(), "wb");
+    if (!f)
+        return;
+    bool ok = fwrite(&header, sizeof(header), 1, f) == 1;
+    ok = ok && fwrite(bytecode.data(), 1, bytecode.size(), f) == bytecode.size();
+    ok = fclose(f) == 0 && ok;
+    if (ok)
+    {
+        remove(cache_file.c_str());
+        ok = rename(tmp_file.c_str(), cache_file.c_str()) == 0;
+    }
+    if (!ok)
+    {
+        LOG(WARNING) << "Failed to write script cache " << cache_file;
+        remove(tmp_file.c_str());
+    }
+}
+
+// Loads the script as a function on the stack, like luaL_loadbuffer, from the script cache if possible.
+static int loadScript(lua_State* L, const string& filename, const string& contents)
+{
+    string chunk_name = "@" + filename;
+    if (script_cache_path.empty())
+        return luaL_loadbuffer(L, contents.c_str(), contents.length(), chunk_name.c_str());
+
+    char name[32];
+    snprintf(name, sizeof(name), "%016llx.luac", static_cast<unsigned long long>(hashScriptData(filename.data(), filename.size())));
+    string cache_file = script_cache_path + "/" + name;
+    auto source_hash = hashScriptData(contents.data(), contents.size());
+    std::vector<char> bytecode;
+    if (loadScriptCache(cache_file, source_hash, contents.size(), bytecode))
+    {
+        // Lua checks the version and number format of the bytecode itself, if it does not match the source is used.
+        if (luaL_loadbufferx(L, bytecode.data(), bytecode.size(), chunk_name.c_str(), "b") == LUA_OK)
+            return LUA_OK;
+        lua_pop(L, 1);
+    }
+    auto result = luaL_loadbuffer(L, contents.c_str(), contents.length(), chunk_name.c_str());
+    if (result == LUA_OK)
+        saveScriptCache(L, cache_file, source_hash, contents.size());
+    return result;
+}
 
 /// void require(string filename)
 /// Runs the Lua script with the given filename in the same context as the running Script.
@@ -66,7 +207,7 @@ static int luaRequire(lua_State* L)
             stream->destroy();
             stream = nullptr;
 
-            if (luaL_loadbuffer(L, filecontents.c_str(), filecontents.length(), ("@" + filename).c_str()))
+            if (loadScript(L, filename, filecontents))
             {
                 string error_string = luaL_checkstring(L, -1);
                 lua_pushstring(L, ("require:" + error_string).c_str());
@@ -109,6 +250,44 @@ static sp::ecs::Entity luaCreateEntity()
     return sp::ecs::Entity::create();
 }
 
+static int luaSpawnBatch(lua_State* L)
+{
+    luaL_checktype(L, 1, LUA_TTABLE);
+    luaL_checktype(L, 2, LUA_TTABLE);
+    bool has_init = !lua_isnoneornil(L, 3);
+    if (has_init)
+        luaL_checktype(L, 3, LUA_TFUNCTION);
+    lua_settop(L, 3);
+
+    auto count = lua_rawlen(L, 2);
+    lua_createtable(L, count, 0);
+    for(lua_Integer idx=1; idx<=lua_Integer(count); idx++)
+    {
+        if (lua_rawgeti(L, 2, idx) != LUA_TTABLE)
+            return luaL_error(L, "spawnBatch: position %d is not a {x, y} table", int(idx));
+        lua_rawgeti(L, -1, 1);
+        lua_rawgeti(L, -2, 2);
+        glm::vec2 position{float(luaL_checknumber(L, -2)), float(luaL_checknumber(L, -1))};
+        lua_pop(L, 3);
+
+        auto entity = sp::ecs::Entity::create();
+        sp::script::Convert<sp::ecs::Entity>::toLua(L, entity);
+        // Same as entity.components = components in Lua, every entity gets its own copy of the values.
+        lua_pushvalue(L, 1);
+        lua_setfield(L, -2, "components");
+        entity.getOrAddComponent<sp::Transform>().setPosition(position);
+        if (has_init)
+        {
+            lua_pushvalue(L, 3);
+            lua_pushvalue(L, -2);
+            lua_pushinteger(L, idx);
+            lua_call(L, 2, 0);
+        }
+        lua_rawseti(L, 4, idx);
+    }
+    return 1;
+}
+
 static int luaQueryEntities(lua_State* L)
 {
     auto key = luaL_checkstring(L, 1);
@@ -255,6 +434,11 @@ static void luaClearGMFunctions()
     gameGlobalInfo->gm_callback_functions.clear();
 }
 
+static string luaGetScriptProfile()
+{
+    return ScriptProfiler::getReport();
+}
+
 static int luaCreateAdditionalScript(lua_State* L)
 {
     auto env = std::make_unique<sp::script::Environment>(gameGlobalInfo->script_environment_base.get());
@@ -270,8 +454,8 @@ static int luaCreateAdditionalScript(lua_State* L)
             auto ptr = reinterpret_cast<sp::script::Environment**>(luaL_checkudata(LL, 1, "ScriptObject"));
             if (!ptr) return 0;
             string filename = luaL_checkstring(LL, 2);
-            i18n::load("locale/" + filename.replace(".lua", "." + PreferencesManager::get("language", "en") + ".po"));
-            auto res = (*ptr)->runFile<void>(filename);
+            // Through require, so the compiled script can come from the script cache. It also loads the translations of the script.
+            auto res = (*ptr)->call<void>("require", filename);
             LuaConsole::checkResult(res);
             if (res.isOk()) {
                 res = (*ptr)->call<void>("init");
@@ -369,6 +553,13 @@ static void luaSetDefaultSkybox(string skybox)
     gameGlobalInfo->default_skybox = skybox;
 }
 
+static void luaPrefetchMesh(string mesh)
+{
+    // A headless server never renders, so it has no use for meshes.
+    if (PreferencesManager::get("headless") == "")
+        Mesh::prefetch(mesh);
+}
+
 static float luaGetScenarioTime()
 {
     return gameGlobalInfo->elapsed_time;
@@ -1099,6 +1290,16 @@ bool setupScriptEnvironment(sp::script::Environment& env)
     
     env.setGlobal("createEntity", &luaCreateEntity);
     env.setGlobal("getEntitiesWithComponent", &luaQueryEntities);
+    /// table spawnBatch(table components, table positions, std::optional<function> init)
+    /// Creates an entity for every {x, y} position, with the given components, in a single call.
+    /// This is much faster than creating the entities one by one from a Lua loop, for asteroid fields, mine belts and such.
+    /// The optional init function is called with each entity and its index, for changes per entity.
+    /// Returns a table with the created entities.
+    /// Example:
+    ///   spawnBatch({transform={}, radar_trace={icon="radar/blip.png", radius=120}, physics={type="Sensor", size=120}},
+    ///       {{1000, 0}, {2000, 0}, {3000, 0}},
+    ///       function(entity, index) entity.components.transform.rotation = random(0, 360) end)
+    env.setGlobal("spawnBatch", &luaSpawnBatch);
     env.setGlobal("getLuaEntityFunctionTable", &luaGetEntityFunctionTable);
     
     env.setGlobal("createClass", &luaCreateClass);
@@ -1146,6 +1347,11 @@ bool setupScriptEnvironment(sp::script::Environment& env)
     /// Sets the default skybox to show, "default" is the default skybox. See resources/skybox for other options.
     /// Example: setDefaultSkybox("You will soon die!")
     env.setGlobal("setDefaultSkybox", &luaSetDefaultSkybox);
+    /// void prefetchMesh(string mesh)
+    /// Starts loading a 3D mesh in the background, so it does not need to be loaded when an object using it is first shown.
+    /// Meshes of objects created during scenario initialization are loaded automatically, use this for objects that are created later.
+    /// Example: prefetchMesh("space_station_1/space_station_1.model")
+    env.setGlobal("prefetchMesh", &luaPrefetchMesh);
     /// float getScenarioTime()
     /// Returns the elapsed time of the scenario, in seconds.
     /// This timer stops when the game is paused.
@@ -1302,6 +1508,12 @@ bool setupScriptEnvironment(sp::script::Environment& env)
 
     env.setGlobal("Script", &luaCreateAdditionalScript);
 
+    /// string getScriptProfile()
+    /// Returns a report of the time and Lua instructions used by the scenario update, comms, GM functions and other callbacks,
+    /// and the Lua functions that used the most instructions, since the scenario started.
+    /// Example: print(getScriptProfile()) -- in the Lua console
+    env.setGlobal("getScriptProfile", &luaGetScriptProfile);
+
     /// void setCommsMessage(string message)
     /// Sets the content of an accepted hail, or in a comms reply.
     /// If no message is set, attempting to open comms results in "no reply", or a dialogue with the message "?" in a reply.
@@ -1357,6 +1569,7 @@ bool setupScriptEnvironment(sp::script::Environment& env)
     registerScriptDataStorageFunctions(env);
     registerScriptGMFunctions(env);
     registerScriptRandomFunctions(env);
+    ScriptProfiler::install(env);
 
     auto res = env.runFile<void>("luax.lua");
     LuaConsole::checkResult(res);
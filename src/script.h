@@ -5,5 +5,7 @@
 
 void setupSubEnvironment(sp::script::Environment& env);
 bool setupScriptEnvironment(sp::script::Environment& env);
+// Enables the cache of compiled scripts used by require.
+void setScriptCachePath(const string& path);
 
 #endif//SCRIPT_H
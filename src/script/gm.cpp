@@ -1,5 +1,6 @@
 #include "gameGlobalInfo.h"
 #include "menus/luaConsole.h"
+#include "scriptProfiler.h"
 #include "screens/gm/gameMasterScreen.h"
 
 
@@ -48,6 +49,7 @@ static void lua_onGMClick(sp::script::Callback callback)
 {
     if (callback) {
         gameGlobalInfo->on_gm_click=[callback](glm::vec2 position) mutable {
+            ScriptProfiler::Scope scope("onGMClick");
             auto res = callback.call<void>(position.x, position.y);
             LuaConsole::checkResult(res);
         };
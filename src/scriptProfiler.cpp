@@ -0,0 +1,201 @@
+#include "scriptProfiler.h"
+#include "preferenceManager.h"
+#include "menus/luaConsole.h"
+
+#include <algorithm>
+
+
+int ScriptProfiler::depth = 0;
+const char* ScriptProfiler::current_scope = nullptr;
+uint64_t ScriptProfiler::instruction_count = 0;
+uint64_t ScriptProfiler::scope_instruction_start = 0;
+bool ScriptProfiler::scope_over_budget = false;
+uint64_t ScriptProfiler::instruction_budget = 0;
+bool ScriptProfiler::abort_over_budget = false;
+bool ScriptProfiler::sample_functions = false;
+std::mutex ScriptProfiler::mutex;
+std::unordered_map<const char*, ScriptProfiler::CallbackStats> ScriptProfiler::callbacks;
+std::unordered_map<ScriptProfiler::FunctionKey, ScriptProfiler::FunctionSamples, ScriptProfiler::FunctionKeyHash> ScriptProfiler::functions;
+
+
+ScriptProfiler::Scope::Scope(const char* name)
+: profiler_scope(name), name(depth == 0 ? name : nullptr)
+{
+    depth++;
+    if (this->name)
+    {
+        current_scope = name;
+        scope_instruction_start = instruction_count;
+        scope_over_budget = false;
+        start = clock::now();
+    }
+}
+
+ScriptProfiler::Scope::~Scope()
+{
+    depth--;
+    if (!name)
+        return;
+    auto time = std::chrono::duration<float, std::milli>(clock::now() - start).count();
+    auto instructions = instruction_count - scope_instruction_start;
+    current_scope = nullptr;
+
+    std::lock_guard<std::mutex> lock(mutex);
+    auto& stats = callbacks[name];
+    stats.name = name;
+    stats.calls++;
+    stats.total += time;
+    stats.last = time;
+    stats.max = std::max(stats.max, time);
+    stats.instructions += instructions;
+    stats.max_instructions = std::max(stats.max_instructions, instructions);
+    if (scope_over_budget)
+        stats.over_budget++;
+}
+
+void ScriptProfiler::install(sp::script::Environment& env)
+{
+    // The environment does not give access to its Lua state, so the hook is installed from a function called inside it.
+    env.setGlobal("__installScriptProfiler", &luaInstallHook);
+    LuaConsole::checkResult(env.call<void>("__installScriptProfiler"));
+}
+
+int ScriptProfiler::luaInstallHook(lua_State* L)
+{
+    installHook(L);
+    return 0;
+}
+
+void ScriptProfiler::installHook(lua_State* L)
+{
+    // Coroutines copy the hook of the thread that creates them, so set it on the main thread as well.
+    lua_rawgeti(L, LUA_REGISTRYINDEX, LUA_RIDX_MAINTHREAD);
+    auto main_thread = lua_tothread(L, -1);
+    lua_pop(L, 1);
+    if (main_thread && main_thread != L)
+        lua_sethook(main_thread, &hook, LUA_MASKCOUNT, sample_interval);
+    lua_sethook(L, &hook, LUA_MASKCOUNT, sample_interval);
+}
+
+void ScriptProfiler::reset()
+{
+    instruction_budget = std::max(0, PreferencesManager::get("script_instruction_budget", "0").toInt());
+    abort_over_budget = PreferencesManager::get("script_budget_action", "warn") == "abort";
+    sample_functions = PreferencesManager::get("script_profiler", "0") == "1";
+
+    std::lock_guard<std::mutex> lock(mutex);
+    callbacks.clear();
+    functions.clear();
+}
+
+void ScriptProfiler::hook(lua_State* L, lua_Debug* ar)
+{
+    instruction_count += sample_interval;
+    if (sample_functions && lua_getinfo(L, "S", ar))
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto [it, inserted] = functions.try_emplace(FunctionKey{ar->source, ar->linedefined});
+        if (inserted)
+            it->second.source = ar->source;
+        it->second.instructions += sample_interval;
+    }
+
+    if (!current_scope || !instruction_budget || instruction_count - scope_instruction_start <= instruction_budget)
+        return;
+    if (abort_over_budget)
+    {
+        // Keep raising errors for as long as the call continues, in case the script catches them with pcall.
+        scope_over_budget = true;
+        luaL_error(L, "%s used more than %d Lua instructions, aborted", current_scope, int(instruction_budget));
+    }
+    else if (!scope_over_budget)
+    {
+        scope_over_budget = true;
+        LuaConsole::addLog(string(current_scope) + " used more than " + string(int(instruction_budget)) + " Lua instructions");
+    }
+}
+
+std::vector<ScriptProfiler::CallbackStats> ScriptProfiler::getCallbackStats()
+{
+    std::vector<CallbackStats> result;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        for(auto& it : callbacks)
+            result.push_back(it.second);
+    }
+    std::sort(result.begin(), result.end(), [](const CallbackStats& a, const CallbackStats& b) { return a.total > b.total; });
+    return result;
+}
+
+static string functionName(const std::string& source, int line)
+{
+    // Like the short_src of Lua: file names start with '@' or '=', anything else is the code itself.
+    if (!source.empty() && (source[0] == '@' || source[0] == '='))
+        return string(source.substr(1)) + ":" + string(line);
+    return "[string]:" + string(line);
+}
+
+std::vector<ScriptProfiler::FunctionStats> ScriptProfiler::getFunctionStats(size_t max_count)
+{
+    // A script that is loaded again gets a new source string, so merge functions with the same name.
+    std::unordered_map<std::string, uint64_t> merged;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        for(auto& [key, samples] : functions)
+            merged[functionName(samples.source, key.line)] += samples.instructions;
+    }
+    std::vector<FunctionStats> result;
+    for(auto& [name, instructions] : merged)
+        result.push_back({name, instructions});
+    std::sort(result.begin(), result.end(), [](const FunctionStats& a, const FunctionStats& b) { return a.instructions > b.instructions; });
+    if (result.size() > max_count)
+        result.resize(max_count);
+    return result;
+}
+
+string ScriptProfiler::getReport()
+{
+    string report = "Script calls (calls, total ms, average ms, max ms, instructions):";
+    for(auto& stats : getCallbackStats())
+    {
+        report += "\n  " + stats.name + ": " + string(stats.calls) + ", " + string(stats.total, 1) + ", " + string(stats.total / stats.calls, 3) + ", " + string(stats.max, 3) + ", " + std::to_string(stats.instructions);
+        if (stats.over_budget)
+            report += " (" + string(stats.over_budget) + " over budget)";
+    }
+    if (!sample_functions)
+        return report + "\nLua functions are not sampled, set the script_profiler preference to 1 to enable this.";
+    report += "\nLua functions (sampled instructions):";
+    for(auto& stats : getFunctionStats(10))
+        report += "\n  " + stats.name + ": " + std::to_string(stats.instructions);
+    return report;
+}
+
+static string jsonString(const string& str)
+{
+    return "\"" + str.replace("\\", "\\\\").replace("\"", "\\\"") + "\"";
+}
+
+string ScriptProfiler::getStatsJSON()
+{
+    string json = "{\"sample_interval\": " + string(sample_interval) + ", \"instruction_budget\": " + std::to_string(instruction_budget) + ", \"calls\": [";
+    bool first = true;
+    for(auto& stats : getCallbackStats())
+    {
+        if (!first)
+            json += ", ";
+        first = false;
+        json += "{\"name\": " + jsonString(stats.name) + ", \"calls\": " + string(stats.calls) + ", \"total\": " + string(stats.total, 3) + ", \"last\": " + string(stats.last, 3) + ", \"max\": " + string(stats.max, 3);
+        json += ", \"instructions\": " + std::to_string(stats.instructions) + ", \"max_instructions\": " + std::to_string(stats.max_instructions) + ", \"over_budget\": " + string(stats.over_budget) + "}";
+    }
+    json += "], \"functions\": [";
+    first = true;
+    for(auto& stats : getFunctionStats(100))
+    {
+        if (!first)
+            json += ", ";
+        first = false;
+        json += "{\"name\": " + jsonString(stats.name) + ", \"instructions\": " + std::to_string(stats.instructions) + "}";
+    }
+    json += "]}";
+    return json;
+}
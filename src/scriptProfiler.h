@@ -0,0 +1,116 @@
+#ifndef SCRIPT_PROFILER_H
+#define SCRIPT_PROFILER_H
+
+#include "script/environment.h"
+#include "profiler.h"
+#include "stringImproved.h"
+
+#include <chrono>
+#include <vector>
+#include <unordered_map>
+#include <mutex>
+
+/*
+ * Accounts the time and Lua instructions spend in calls from C++ into the scenario scripts.
+ * Calls are wrapped in a ScriptProfiler::Scope, named after the kind of call (update, comms, GM function, ...).
+ * A Lua count hook runs every sample_interval instructions. It adds the instructions to the current scope.
+ *  With the script_profiler preference set to 1 it also counts a sample for the Lua function that is running,
+ *  so the functions that use the most time can be found. This is off by default, as it costs some time on every sample.
+ * With the script_instruction_budget preference a single call can be limited to a number of instructions.
+ *  A call that goes over the budget is reported, with script_budget_action=abort it is stopped with an error,
+ *  so a runaway script cannot freeze the server.
+ * The results are available from Lua with getScriptProfile(), which the Lua console can print,
+ *  and on /script_profiler.json of the HTTP server.
+ */
+class ScriptProfiler
+{
+    using clock = std::chrono::steady_clock;
+public:
+    class Scope
+    {
+    public:
+        // The name is not copied, it has to be a literal. Nested scopes are accounted to the outermost scope.
+        explicit Scope(const char* name);
+        ~Scope();
+
+        Scope(const Scope&) = delete;
+        Scope& operator=(const Scope&) = delete;
+    private:
+        Profiler::Scope profiler_scope;
+        const char* name;
+        clock::time_point start;
+    };
+
+    struct CallbackStats
+    {
+        string name;
+        int calls = 0;
+        // Time spend in the calls, in milliseconds.
+        float total = 0.0f;
+        float last = 0.0f;
+        float max = 0.0f;
+        // Sampled instruction counts, in multiples of sample_interval.
+        uint64_t instructions = 0;
+        uint64_t max_instructions = 0;
+        int over_budget = 0;
+    };
+    struct FunctionStats
+    {
+        string name;
+        uint64_t instructions;
+    };
+
+    // Installs the count hook on the Lua state of the environment.
+    static void install(sp::script::Environment& env);
+    // Clears the collected stats and reads the budget preferences, called when a scenario starts.
+    static void reset();
+
+    // Stats of all scopes, sorted on total time, highest first.
+    static std::vector<CallbackStats> getCallbackStats();
+    // Lua functions with the most samples, highest first.
+    static std::vector<FunctionStats> getFunctionStats(size_t max_count);
+    static string getReport();
+    static string getStatsJSON();
+
+private:
+    static constexpr int sample_interval = 1000;
+
+    static void installHook(lua_State* L);
+    static void hook(lua_State* L, lua_Debug* ar);
+    static int luaInstallHook(lua_State* L);
+
+    // Functions are counted on the address of their source string, the name is only formatted for the reports.
+    //  The source is copied when a function is first seen, so the name is still known after the function is collected.
+    struct FunctionKey
+    {
+        const char* source;
+        int line;
+
+        bool operator==(const FunctionKey& other) const { return source == other.source && line == other.line; }
+    };
+    struct FunctionKeyHash
+    {
+        size_t operator()(const FunctionKey& key) const { return std::hash<const char*>()(key.source) ^ (size_t(key.line) * 31); }
+    };
+    struct FunctionSamples
+    {
+        std::string source;
+        uint64_t instructions = 0;
+    };
+
+    static int depth;
+    static const char* current_scope;
+    static uint64_t instruction_count;
+    static uint64_t scope_instruction_start;
+    static bool scope_over_budget;
+    static uint64_t instruction_budget;
+    static bool abort_over_budget;
+    static bool sample_functions;
+
+    // Guards the data below, which is also read by the HTTP server.
+    static std::mutex mutex;
+    static std::unordered_map<const char*, CallbackStats> callbacks;
+    static std::unordered_map<FunctionKey, FunctionSamples, FunctionKeyHash> functions;
+};
+
+#endif//SCRIPT_PROFILER_H
@@ -26,6 +26,7 @@ namespace ShaderRegistry
             "shaders/basic",
             "shaders/basicColor",
             "shaders/billboard",
+            "shaders/billboardBatch",
             "shaders/objectShader",
             "shaders/objectShader:ILLUMINATION",
             "shaders/objectShader:SPECULAR",
@@ -54,7 +55,8 @@ namespace ShaderRegistry
         std::array<const char*, Attributes_t(Attributes::Count)> attribute_names{
             "position",
             "texcoords",
-            "normal"
+            "normal",
+            "color"
         };
 
         std::array<std::tuple<Uniforms, int32_t>, 4> texture_units{
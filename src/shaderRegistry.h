@@ -29,6 +29,7 @@ namespace ShaderRegistry
 		Basic = 0,
 		BasicColor,
 		Billboard,
+		BillboardBatch,
 		Object,
 		ObjectIllumination,
 		ObjectSpecular,
@@ -68,6 +69,7 @@ namespace ShaderRegistry
 		Position = 0,
 		Texcoords,
 		Normal,
+		Color,
 
 		Count
 	};
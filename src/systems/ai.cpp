@@ -1,17 +1,61 @@
 #include "systems/ai.h"
 #include "components/ai.h"
+#include "components/collision.h"
+#include "components/player.h"
+#include "components/target.h"
 #include "ecs/query.h"
 #include "multiplayer_server.h"
+#include "preferenceManager.h"
 #include "ai/ai.h"
 #include "ai/aiFactory.h"
+#include <glm/gtx/norm.hpp>
+#include <chrono>
 
 
+AISystem::AISystem()
+{
+    update_budget_us = PreferencesManager::get("ai_update_budget", "2000").toInt();
+
+    // The main thread helps with the decisions, so by default use one worker less than the number of cores.
+    worker_count = PreferencesManager::get("ai_threads", string(int(std::thread::hardware_concurrency()) - 1)).toInt();
+}
+
+void AISystem::startWorkers()
+{
+    workers_started = true;
+    for(int n=0; n<worker_count; n++)
+        workers.emplace_back(&AISystem::workerLoop, this);
+}
+
+AISystem::~AISystem()
+{
+    {
+        std::lock_guard<std::mutex> lock(worker_mutex);
+        stop_workers = true;
+    }
+    worker_start.notify_all();
+    for(auto& worker : workers)
+        worker.join();
+}
+
 void AISystem::update(float delta)
 {
     if (delta <= 0.0f) return;
     if (!game_server)
         return;
+    if (!workers_started)
+        startWorkers();
 
+    // The snapshot and the decisions count against the budget as well, so the expensive updates get less time when they took long.
+    auto start = std::chrono::steady_clock::now();
+    auto budget = std::chrono::microseconds(update_budget_us);
+    snapshot_age += delta;
+
+    player_positions.clear();
+    for(auto [entity, player, transform] : sp::ecs::Query<PlayerControl, sp::Transform>())
+        player_positions.push_back(transform.getPosition());
+
+    scheduled.clear();
     for(auto [entity, ai] : sp::ecs::Query<AIController>()) {
         if (ai.new_name.length() && (!ai.ai || ai.ai->canSwitchAI()))
         {
@@ -21,7 +65,104 @@ void AISystem::update(float delta)
                 ai.ai = f(entity);
             ai.new_name = "";
         }
-        if (ai.ai)
-            ai.ai->run(delta);
+        if (!ai.ai)
+            continue;
+
+        ai.ai->expensive_update_age += delta;
+        float priority = ai.ai->expensive_update_age;
+        if (entity.hasComponent<Target>()) {
+            priority *= combat_priority;
+        } else if (auto transform = entity.getComponent<sp::Transform>()) {
+            for(auto position : player_positions) {
+                if (glm::length2(position - transform->getPosition()) < near_player_range * near_player_range) {
+                    priority *= near_player_priority;
+                    break;
+                }
+            }
+        }
+        scheduled.push_back({entity, priority});
+    }
+
+    if (update_budget_us > 0)
+        std::sort(scheduled.begin(), scheduled.end(), [](const ScheduledAI& a, const ScheduledAI& b) { return a.priority > b.priority; });
+
+    decisions.clear();
+    for(auto& s : scheduled) {
+        auto ai = s.entity.getComponent<AIController>();
+        if (ai->ai->prepareTargetDecision(delta))
+            decisions.push_back(ai->ai.get());
+    }
+    if (!decisions.empty()) {
+        AISnapshot::prepare();
+        if (snapshot_age >= max_snapshot_age || snapshot.isOutdated()) {
+            snapshot.build();
+            snapshot_age = 0.0f;
+        }
+        runDecisions();
+    }
+
+    bool budget_left = true;
+    for(auto& s : scheduled) {
+        // Look up the AI again, running an AI can create or destroy other entities.
+        auto ai = s.entity.getComponent<AIController>();
+        if (!ai || !ai->ai)
+            continue;
+        if (budget_left && update_budget_us > 0 && std::chrono::steady_clock::now() - start > budget)
+            budget_left = false;
+        bool expensive = budget_left || ai->ai->expensive_update_age >= max_expensive_update_age;
+        ai->ai->allow_expensive_update = expensive;
+        ai->ai->applyTargetDecision();
+        ai->ai->run(delta);
+        if (expensive)
+            ai->ai->expensive_update_age = 0.0f;
+    }
+}
+
+void AISystem::runDecisions()
+{
+    next_decision = 0;
+    if (workers.empty() || decisions.size() < min_parallel_decisions) {
+        decideTargets();
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(worker_mutex);
+        work_generation++;
+        busy_workers = workers.size();
+    }
+    worker_start.notify_all();
+    decideTargets();
+    std::unique_lock<std::mutex> lock(worker_mutex);
+    worker_done.wait(lock, [this]() { return busy_workers == 0; });
+}
+
+void AISystem::decideTargets()
+{
+    while(true) {
+        size_t index = next_decision++;
+        if (index >= decisions.size())
+            break;
+        decisions[index]->decideTarget(snapshot);
+    }
+}
+
+void AISystem::workerLoop()
+{
+    uint32_t generation = 0;
+    while(true) {
+        {
+            std::unique_lock<std::mutex> lock(worker_mutex);
+            worker_start.wait(lock, [this, generation]() { return stop_workers || work_generation != generation; });
+            if (stop_workers)
+                return;
+            generation = work_generation;
+        }
+        decideTargets();
+        {
+            std::lock_guard<std::mutex> lock(worker_mutex);
+            busy_workers--;
+        }
+        worker_done.notify_one();
     }
 }
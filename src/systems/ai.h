@@ -1,10 +1,71 @@
 #pragma once
 
 #include "ecs/system.h"
+#include "ecs/entity.h"
+#include "ai/aiSnapshot.h"
+#include <glm/vec2.hpp>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
 
 
+// The AI system runs all ShipAIs every frame, but the expensive weapon state update
+//  is spread over frames within a time budget. AIs that are in combat, or close to player ships, get priority.
+//  Steering and following orders still runs every frame for every AI.
+// Target selection is split from the rest of the AI. The decision which target to pick only reads from a snapshot
+//  of the world, so it runs on a pool of worker threads. The result is applied on the main thread before running the AI.
+class ShipAI;
 class AISystem : public sp::ecs::System
 {
 public:
+    AISystem();
+    ~AISystem();
+
     void update(float delta) override;
+
+private:
+    // Number of worker threads, they are only started once the first server side update runs, clients never need them.
+    int worker_count;
+    bool workers_started = false;
+
+    // Time budget in microseconds for the AIs that do an expensive update each frame, 0 for no limit.
+    int update_budget_us;
+
+    // An AI will always get an expensive update when it did not get one for this long, even if there is no budget left.
+    static constexpr float max_expensive_update_age = 1.0f;
+    static constexpr float combat_priority = 4.0f;
+    static constexpr float near_player_priority = 2.0f;
+    static constexpr float near_player_range = 20000.0f;
+
+    struct ScheduledAI {
+        sp::ecs::Entity entity;
+        float priority;
+    };
+    std::vector<ScheduledAI> scheduled;
+    std::vector<glm::vec2> player_positions;
+
+    // With fewer decisions than this, starting the workers costs more than it saves.
+    static constexpr size_t min_parallel_decisions = 8;
+
+    // Decisions for each AI are only made every 0.25 to 0.5 seconds, so positions this old make no difference.
+    static constexpr float max_snapshot_age = 0.2f;
+    AISnapshot snapshot;
+    float snapshot_age = max_snapshot_age;
+    std::vector<ShipAI*> decisions;
+    std::atomic<size_t> next_decision{0};
+
+    std::vector<std::thread> workers;
+    std::mutex worker_mutex;
+    std::condition_variable worker_start;
+    std::condition_variable worker_done;
+    uint32_t work_generation = 0;
+    size_t busy_workers = 0;
+    bool stop_workers = false;
+
+    void startWorkers();
+    void runDecisions();
+    void decideTargets();
+    void workerLoop();
 };
@@ -6,6 +6,7 @@
 #include "ecs/query.h"
 #include "vectorUtils.h"
 #include "menus/luaConsole.h"
+#include "scriptProfiler.h"
 #include "multiplayer_server.h"
 
 
@@ -43,7 +44,10 @@ void BasicMovementSystem::update(float delta)
         else if (game_server)
         {
             if (moveto.on_arrival)
+            {
+                ScriptProfiler::Scope scope("on_arrival");
                 LuaConsole::checkResult(moveto.on_arrival.call<void>(entity, transform.getPosition().x, transform.getPosition().y));
+            }
             entity.removeComponent<MoveTo>();
         }
     }
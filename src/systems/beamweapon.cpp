@@ -134,7 +134,7 @@ void BeamWeaponSystem::update(float delta)
                             DamageInfo info(entity, mount.damage_type, hit_location);
                             info.frequency = beamsys.frequency;
                             info.system_target = beamsys.system_target;
-                            DamageSystem::applyDamage(target.entity, mount.damage, info);
+                            DamageSystem::queueDamage(target.entity, mount.damage, info);
                         }
                     }
                 }
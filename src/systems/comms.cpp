@@ -9,6 +9,7 @@
 #include "ecs/query.h"
 #include "gui/colorConfig.h"
 #include "menus/luaConsole.h"
+#include "scriptProfiler.h"
 
 
 static sp::ecs::Entity script_active_entity;
@@ -273,6 +274,7 @@ void CommsSystem::selectScriptReply(sp::ecs::Entity player, int index)
         transmitter->script_replies.clear();
         transmitter->script_replies_dirty = true;
         transmitter->incomming_message = "?";
+        ScriptProfiler::Scope scope("comms reply");
         LuaConsole::checkResult(callback.call<void>(player, transmitter->target));
     }
 
@@ -358,12 +360,14 @@ bool CommsSystem::openChannel(sp::ecs::Entity player, sp::ecs::Entity target)
         env.script_environment->setGlobal("player", player);
         env.script_environment->setGlobal("comms_source", player);
         env.script_environment->setGlobal("comms_target", target);
-        i18n::load("locale/" + script_name.replace(".lua", "." + PreferencesManager::get("language", "en") + ".po"));
-        LuaConsole::checkResult(env.script_environment->runFile<void>(script_name));
+        ScriptProfiler::Scope scope("comms script");
+        // Through require, so the compiled script can come from the script cache. It also loads the translations of the script.
+        LuaConsole::checkResult(env.script_environment->call<void>("require", script_name));
     }else if (receiver->callback)
     {
         receiver->callback.setGlobal("comms_source", player);
         receiver->callback.setGlobal("comms_target", transmitter->target);
+        ScriptProfiler::Scope scope("comms function");
         LuaConsole::checkResult(receiver->callback.call<void>(player, target));
     }
     script_active_entity = {};
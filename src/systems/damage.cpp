@@ -11,6 +11,17 @@
 #include <glm/geometric.hpp>
 #include "random.h"
 #include "menus/luaConsole.h"
+#include "logging.h"
+#include <algorithm>
+
+
+std::vector<DamageSystem::AreaDamage> DamageSystem::area_queue;
+std::vector<DamageSystem::PointDamage> DamageSystem::damage_queue;
+std::vector<DamageSystem::PointDamage> DamageSystem::resolving;
+uint32_t DamageSystem::queue_order = 0;
+std::vector<DamageEvent> DamageSystem::events;
+uint64_t DamageSystem::events_start = 0;
+size_t DamageSystem::previous_frame_events = 0;
 
 
 void DamageSystem::update(float delta)
@@ -19,34 +30,103 @@ void DamageSystem::update(float delta)
         if (hull.damage_indicator > 0.0f)
             hull.damage_indicator -= delta;
     }
+
+    // Drop the events from the previous frame, everyone has seen them by now.
+    events.erase(events.begin(), events.begin() + previous_frame_events);
+    events_start += previous_frame_events;
+    resolveQueue();
+    previous_frame_events = events.size();
 }
 
 void DamageSystem::damageArea(glm::vec2 position, float blast_range, float min_damage, float max_damage, const DamageInfo& info, float min_range)
 {
-    for(auto entity : sp::CollisionSystem::queryArea(position - glm::vec2(blast_range, blast_range), position + glm::vec2(blast_range, blast_range)))
+    area_queue.push_back({position, blast_range, min_damage, max_damage, min_range, info, queue_order++});
+}
+
+void DamageSystem::queueDamage(sp::ecs::Entity entity, float amount, const DamageInfo& info)
+{
+    damage_queue.push_back({entity, amount, info, queue_order++});
+}
+
+void DamageSystem::applyDamage(sp::ecs::Entity entity, float amount, const DamageInfo& info)
+{
+    Target target{entity};
+    target.lookup();
+    applyDamage(target, amount, info);
+}
+
+void DamageSystem::Target::lookup()
+{
+    transform = entity.getComponent<sp::Transform>();
+    shields = entity.getComponent<Shields>();
+    hull = entity.getComponent<Hull>();
+    destroyed_by_area_damage = entity.getComponent<DestroyedByAreaDamage>();
+}
+
+void DamageSystem::resolveQueue()
+{
+    for(int pass=0; pass<max_resolve_passes && (!area_queue.empty() || !damage_queue.empty()); pass++)
     {
-        auto transform = entity.getComponent<sp::Transform>();
-        if (!transform) continue;
-        auto physics = entity.getComponent<sp::Physics>();
-        if (!physics) continue;
-
-        float dist = glm::length(position - transform->getPosition()) - physics->getSize().x - min_range;
-        if (dist < 0) dist = 0;
-        if (dist < blast_range - min_range)
+        // Take the current queue, anything that gets queued while resolving is handled in the next pass.
+        resolving.clear();
+        std::swap(resolving, damage_queue);
+        for(auto& area : area_queue)
+        {
+            for(auto entity : sp::CollisionSystem::queryArea(area.position - glm::vec2(area.blast_range, area.blast_range), area.position + glm::vec2(area.blast_range, area.blast_range)))
+            {
+                auto transform = entity.getComponent<sp::Transform>();
+                if (!transform) continue;
+                auto physics = entity.getComponent<sp::Physics>();
+                if (!physics) continue;
+
+                float dist = glm::length(area.position - transform->getPosition()) - physics->getSize().x - area.min_range;
+                if (dist < 0) dist = 0;
+                if (dist < area.blast_range - area.min_range)
+                    resolving.push_back({entity, area.max_damage - (area.max_damage - area.min_damage) * dist / (area.blast_range - area.min_range), area.info, area.order});
+            }
+        }
+        area_queue.clear();
+
+        // Group all damage per entity, in the order it was queued.
+        std::sort(resolving.begin(), resolving.end(), [](const PointDamage& a, const PointDamage& b) {
+            if (a.entity.getIndex() != b.entity.getIndex())
+                return a.entity.getIndex() < b.entity.getIndex();
+            if (a.entity.getVersion() != b.entity.getVersion())
+                return a.entity.getVersion() < b.entity.getVersion();
+            return a.order < b.order;
+        });
+        for(size_t n=0; n<resolving.size(); )
         {
-            applyDamage(entity, max_damage - (max_damage - min_damage) * dist / (blast_range - min_range), info);
+            Target target{resolving[n].entity};
+            target.lookup();
+            for(; n<resolving.size() && resolving[n].entity == target.entity; n++)
+            {
+                // Stop once an earlier hit destroyed the entity.
+                if (target.entity)
+                    applyDamage(target, resolving[n].amount, resolving[n].info);
+            }
         }
     }
+    if (!area_queue.empty() || !damage_queue.empty())
+    {
+        LOG(WARNING) << "Damage still queued after " << max_resolve_passes << " passes, delaying it to the next frame.";
+    }
+    queue_order = 0;
 }
 
-void DamageSystem::applyDamage(sp::ecs::Entity entity, float amount, const DamageInfo& info)
+void DamageSystem::applyDamage(Target& target, float amount, const DamageInfo& info)
 {
-    auto shields = entity.getComponent<Shields>();
+    if (!target.entity)
+        return;
+    DamageEvent event;
+    event.entity = target.entity;
+    event.info = info;
+
+    auto shields = target.shields;
     if (shields && shields->active && !shields->entries.empty()) {
-        auto transform = entity.getComponent<sp::Transform>();
         float angle = 0;
-        if (transform) {
-            angle = angleDifference(transform->getRotation(), vec2ToAngle(info.location - transform->getPosition()));
+        if (target.transform) {
+            angle = angleDifference(target.transform->getRotation(), vec2ToAngle(info.location - target.transform->getPosition()));
             if (angle < 0)
                 angle += 360.0f;
         }
@@ -66,6 +146,7 @@ void DamageSystem::applyDamage(sp::ecs::Entity entity, float amount, const Damag
         float shield_damage_factor = shields->getDamageFactor(shield_index);
 
         float shield_damage = amount * shield_damage_factor * frequency_damage_factor;
+        event.shield_damage = std::min(shield_damage, shield.level);
         amount -= shield.level;
         shield.level -= shield_damage;
         if (shield.level < 0)
@@ -82,18 +163,21 @@ void DamageSystem::applyDamage(sp::ecs::Entity entity, float amount, const Damag
 
     if (amount > 0.0f)
     {
-        takeHullDamage(entity, amount, info);
-        if (auto dbad = entity.getComponent<DestroyedByAreaDamage>()) {
-            if (dbad->damaged_by_flags & (1 << int(info.type))) {
-                entity.destroy();
+        takeHullDamage(target, amount, info, event);
+        if (target.entity && target.destroyed_by_area_damage) {
+            if (target.destroyed_by_area_damage->damaged_by_flags & (1 << int(info.type))) {
+                target.entity.destroy();
+                event.destroyed = true;
             }
         }
     }
+    events.push_back(event);
 }
 
-void DamageSystem::takeHullDamage(sp::ecs::Entity entity, float amount, const DamageInfo& info)
+void DamageSystem::takeHullDamage(Target& target, float amount, const DamageInfo& info, DamageEvent& event)
 {
-    auto hull = entity.getComponent<Hull>();
+    auto entity = target.entity;
+    auto hull = target.hull;
     if (!hull)
         return;
     if (!(hull->damaged_by_flags & (1 << int(info.type))))
@@ -147,6 +231,7 @@ void DamageSystem::takeHullDamage(sp::ecs::Entity entity, float amount, const Da
         }
     }
 
+    event.hull_damage = amount;
     hull->current -= amount;
     if (hull->current <= 0.0f && !hull->allow_destruction)
     {
@@ -155,7 +240,8 @@ void DamageSystem::takeHullDamage(sp::ecs::Entity entity, float amount, const Da
 
     if (hull->current <= 0.0f)
     {
-        destroyedByDamage(entity, info);
+        event.destroyed = true;
+        destroyedByDamage(target, info);
         return;
     }
 
@@ -167,12 +253,14 @@ void DamageSystem::takeHullDamage(sp::ecs::Entity entity, float amount, const Da
         } else {
             LuaConsole::checkResult(hull->on_taking_damage.call<void>(entity));
         }
+        target.lookup();
     }
 }
 
-void DamageSystem::destroyedByDamage(sp::ecs::Entity entity, const DamageInfo& info)
+void DamageSystem::destroyedByDamage(Target& target, const DamageInfo& info)
 {
-    if (auto transform = entity.getComponent<sp::Transform>()) {
+    auto entity = target.entity;
+    if (auto transform = target.transform) {
         if (auto physics = entity.getComponent<sp::Physics>()) {
             auto e = sp::ecs::Entity::create();
             e.addComponent<ExplosionEffect>().size = physics->getSize().x * 1.5f;
@@ -185,11 +273,11 @@ void DamageSystem::destroyedByDamage(sp::ecs::Entity entity, const DamageInfo& i
     {
         float points = 0;
 
-        auto hull = entity.getComponent<Hull>();
+        auto hull = target.hull;
         if (hull)
             points += hull->max * 0.1f;
 
-        auto shields = entity.getComponent<Shields>();
+        auto shields = target.shields;
         if (shields && !shields->entries.empty()) {
             for(auto& shield : shields->entries)
                 points += shield.max * 0.1f;
@@ -202,7 +290,7 @@ void DamageSystem::destroyedByDamage(sp::ecs::Entity entity, const DamageInfo& i
             Faction::getInfo(info.instigator).reputation_points = std::max(Faction::getInfo(info.instigator).reputation_points - points, 0.0f);
     }
 
-    auto hull = entity.getComponent<Hull>();
+    auto hull = target.hull;
     if (hull->on_destruction)
     {
         if (info.instigator)
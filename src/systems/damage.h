@@ -3,6 +3,12 @@
 #include "ecs/entity.h"
 #include "ecs/system.h"
 #include "components/shipsystem.h"
+#include "components/collision.h"
+#include <vector>
+
+class Shields;
+class Hull;
+class DestroyedByAreaDamage;
 
 
 enum class DamageType
@@ -31,15 +37,82 @@ public:
 };
 
 
+// Result of damage done to a single entity.
+class DamageEvent
+{
+public:
+    sp::ecs::Entity entity;
+    DamageInfo info;
+    float shield_damage = 0.0f;
+    float hull_damage = 0.0f;
+    bool destroyed = false;
+};
+
 class DamageSystem : public sp::ecs::System
 {
 public:
     void update(float delta) override;
 
+    // Area damage and queued point damage are resolved together in update(), sorted per entity,
+    //  so every hit entity only needs its components looked up once, even in large chains of explosions.
     static void damageArea(glm::vec2 position, float blast_range, float min_damage, float max_damage, const DamageInfo& info, float min_range);
+    static void queueDamage(sp::ecs::Entity entity, float amount, const DamageInfo& info);
+    // Apply damage right away, for callers that need to see the result directly, like scripts.
     static void applyDamage(sp::ecs::Entity entity, float amount, const DamageInfo& info);
 
+    // Read all damage events since the given position in the event stream, and update the position.
+    //  Events are kept until the end of the next frame, so a reader that checks every frame does not miss any.
+    template<typename F> static void readEvents(uint64_t& position, const F& func)
+    {
+        if (position < events_start)
+            position = events_start;
+        for(; position < events_start + events.size(); position++)
+            func(events[position - events_start]);
+    }
+
 private:
-    static void takeHullDamage(sp::ecs::Entity entity, float amount, const DamageInfo& info);
-    static void destroyedByDamage(sp::ecs::Entity entity, const DamageInfo& info);
+    struct AreaDamage
+    {
+        glm::vec2 position;
+        float blast_range;
+        float min_damage;
+        float max_damage;
+        float min_range;
+        DamageInfo info;
+        uint32_t order;
+    };
+    struct PointDamage
+    {
+        sp::ecs::Entity entity;
+        float amount;
+        DamageInfo info;
+        uint32_t order;
+    };
+    // Component pointers of the entity that is being damaged. These need to be looked up again after calling into a script,
+    //  as the script can add or remove components.
+    struct Target
+    {
+        sp::ecs::Entity entity;
+        sp::Transform* transform;
+        Shields* shields;
+        Hull* hull;
+        DestroyedByAreaDamage* destroyed_by_area_damage;
+
+        void lookup();
+    };
+    // Damage can cause more damage, for example trough script callbacks or mines, limit how often we go trough the queue in a single frame.
+    static constexpr int max_resolve_passes = 8;
+
+    static std::vector<AreaDamage> area_queue;
+    static std::vector<PointDamage> damage_queue;
+    static std::vector<PointDamage> resolving;
+    static uint32_t queue_order;
+    static std::vector<DamageEvent> events;
+    static uint64_t events_start;
+    static size_t previous_frame_events;
+
+    static void resolveQueue();
+    static void applyDamage(Target& target, float amount, const DamageInfo& info);
+    static void takeHullDamage(Target& target, float amount, const DamageInfo& info, DamageEvent& event);
+    static void destroyedByDamage(Target& target, const DamageInfo& info);
 };
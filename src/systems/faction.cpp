@@ -0,0 +1,8 @@
+#include "systems/faction.h"
+#include "components/faction.h"
+
+
+void FactionSystem::update(float delta)
+{
+    Faction::updateRelationMatrix();
+}
@@ -0,0 +1,12 @@
+#pragma once
+
+#include "ecs/system.h"
+
+
+// Keeps the faction relation matrix in sync with the relation lists of the factions.
+//  Relations can be changed by scripts and replication without going trough FactionInfo::setRelation, so check each frame.
+class FactionSystem : public sp::ecs::System
+{
+public:
+    void update(float delta) override;
+};
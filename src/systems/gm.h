@@ -9,9 +9,9 @@
 
 class GMRadarRender :
     public sp::ecs::System,
-    public RenderRadarInterface<LongRangeRadar, 11, RadarRenderSystem::FlagGM>,
-    public RenderRadarInterface<AIController, 11, RadarRenderSystem::FlagGM>,
-    public RenderRadarInterface<AllowRadarLink, 11, RadarRenderSystem::FlagGM> {
+    public RenderRadarInterface<LongRangeRadar, 11, RadarRenderSystem::FlagGM, false>,
+    public RenderRadarInterface<AIController, 11, RadarRenderSystem::FlagGM, false>,
+    public RenderRadarInterface<AllowRadarLink, 11, RadarRenderSystem::FlagGM, false> {
 public:
     void update(float delta) override {}
 
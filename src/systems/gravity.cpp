@@ -8,6 +8,7 @@
 #include "ecs/query.h"
 #include "random.h"
 #include "menus/luaConsole.h"
+#include "scriptProfiler.h"
 #include <glm/gtx/norm.hpp>
 
 
@@ -43,6 +44,7 @@ void GravitySystem::update(float delta)
                         tt->setPosition( (grav.wormhole_target + glm::vec2(random(-wormhole_target_spread, wormhole_target_spread), random(-wormhole_target_spread, wormhole_target_spread))));
                         if (grav.on_teleportation)
                         {
+                            ScriptProfiler::Scope scope("on_teleportation");
                             LuaConsole::checkResult(grav.on_teleportation.call<void>(source, target));
                             continue; //callback could destroy the entity, so do no extra processing.
                         }
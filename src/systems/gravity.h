@@ -5,7 +5,7 @@
 #include "components/gravity.h"
 
 
-class GravitySystem : public sp::ecs::System, public RenderRadarInterface<Gravity, 12, RadarRenderSystem::FlagGM>
+class GravitySystem : public sp::ecs::System, public RenderRadarInterface<Gravity, 12, RadarRenderSystem::FlagGM, false>
 {
 public:
     void update(float delta) override;
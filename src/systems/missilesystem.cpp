@@ -167,7 +167,7 @@ void MissileSystem::explode(sp::ecs::Entity source, sp::ecs::Entity target, Expl
     if (eot.blast_range > 100.0f || !target) {
         DamageSystem::damageArea(transform->getPosition(), eot.blast_range, eot.damage_at_edge, eot.damage_at_center, info, eot.blast_range / 2);
     } else {
-        DamageSystem::applyDamage(target, eot.damage_at_center, info);
+        DamageSystem::queueDamage(target, eot.damage_at_center, info);
     }
 
     auto e = sp::ecs::Entity::create();
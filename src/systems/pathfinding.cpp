@@ -4,17 +4,26 @@
 #include "ecs/query.h"
 #include "glm/gtx/norm.hpp"
 #include <math.h>
+#include <algorithm>
 
 const float small_object_grid_size = 5000.0f;
 const float small_object_max_size = 1000.0f;
 static PathFindingSystem* path_finding_system;
 
 
-static uint32_t hashPosition(glm::vec2 position)
+static int cellCoord(float f)
 {
-    uint32_t x = std::floor(position.x / small_object_grid_size);
-    uint32_t y = std::floor(position.y / small_object_grid_size);
-    return x ^ (y << 16);
+    return int(std::floor(f / small_object_grid_size));
+}
+
+static uint64_t cellKey(int x, int y)
+{
+    return (uint64_t(uint32_t(x)) << 32) | uint64_t(uint32_t(y));
+}
+
+static uint64_t cellForPosition(glm::vec2 position)
+{
+    return cellKey(cellCoord(position.x), cellCoord(position.y));
 }
 
 PathFindingSystem::PathFindingSystem()
@@ -22,12 +31,43 @@ PathFindingSystem::PathFindingSystem()
     path_finding_system = this;
 }
 
+void PathFindingSystem::removeFromList(std::vector<Entry>& list, uint32_t slot, AvoidObject::InternalState state, uint64_t cell)
+{
+    // Swap with the last entry, and fix up the slot of the entity that got moved.
+    // The moved entry can be a stale one, which will be removed later, so only fix up if it is the entry the component refers to.
+    uint32_t last = list.size() - 1;
+    if (slot < last)
+    {
+        list[slot] = list[last];
+        auto ao = list[slot].entity.getComponent<AvoidObject>();
+        if (ao && ao->state == state && ao->slot == last && (state == AvoidObject::InternalState::BigEntity || ao->cell == cell))
+            ao->slot = slot;
+    }
+    list.pop_back();
+}
+
 void PathFindingSystem::update(float delta)
 {
-    // Remove any entities that where destroyed.
-    big_entities.erase(std::remove_if(big_entities.begin(), big_entities.end(), [](sp::ecs::Entity e) { return !bool(e); } ), big_entities.end());
-    for(auto it : small_entities)
-        it.second.erase(std::remove_if(it.second.begin(), it.second.end(), [](sp::ecs::Entity e) { return !bool(e); } ), it.second.end());
+    // Remove any entities that where destroyed, or no longer are avoided.
+    for(uint32_t n=0; n<big_entities.size(); )
+    {
+        auto ao = big_entities[n].entity.getComponent<AvoidObject>();
+        if (!ao || ao->state != AvoidObject::InternalState::BigEntity || ao->slot != n)
+            removeFromList(big_entities, n, AvoidObject::InternalState::BigEntity, 0);
+        else
+            n++;
+    }
+    for(auto& [cell, list] : small_entities)
+    {
+        for(uint32_t n=0; n<list.size(); )
+        {
+            auto ao = list[n].entity.getComponent<AvoidObject>();
+            if (!ao || ao->state != AvoidObject::InternalState::SmallEntity || ao->cell != cell || ao->slot != n)
+                removeFromList(list, n, AvoidObject::InternalState::SmallEntity, cell);
+            else
+                n++;
+        }
+    }
 
     for(auto [entity, dao] : sp::ecs::Query<DelayedAvoidObject>()) {
         dao.delay -= delta;
@@ -39,28 +79,42 @@ void PathFindingSystem::update(float delta)
 
     // Update big and small object lists.
     for(auto [entity, ao, transform] : sp::ecs::Query<AvoidObject, sp::Transform>()) {
+        auto position = transform.getPosition();
+        bool big = ao.range > small_object_max_size;
+        auto cell = cellForPosition(position);
         switch(ao.state) {
         case AvoidObject::InternalState::New:
-            if (ao.range > small_object_max_size) {
-                big_entities.push_back(entity);
-                ao.state = AvoidObject::InternalState::BigEntity;
-            } else {
-                ao.position_hash = hashPosition(transform.getPosition());
-                small_entities[ao.position_hash].push_back(entity);
-                ao.state = AvoidObject::InternalState::SmallEntity;
-            }
             break;
         case AvoidObject::InternalState::BigEntity:
+            if (big) {
+                big_entities[ao.slot].position = position;
+                big_entities[ao.slot].range = ao.range;
+                continue;
+            }
+            removeFromList(big_entities, ao.slot, AvoidObject::InternalState::BigEntity, 0);
             break;
         case AvoidObject::InternalState::SmallEntity:
-            if (ao.position_hash != hashPosition(transform.getPosition())) {
-                auto& so = small_entities[ao.position_hash];
-                so.erase(std::remove_if(so.begin(), so.end(), [oe=entity](sp::ecs::Entity e) { return e == oe; } ), so.end());
-                ao.position_hash = hashPosition(transform.getPosition());
-                small_entities[ao.position_hash].push_back(entity);
+            if (!big && ao.cell == cell) {
+                auto& entry = small_entities[ao.cell][ao.slot];
+                entry.position = position;
+                entry.range = ao.range;
+                continue;
             }
+            removeFromList(small_entities[ao.cell], ao.slot, AvoidObject::InternalState::SmallEntity, ao.cell);
             break;
         }
+
+        if (big) {
+            ao.state = AvoidObject::InternalState::BigEntity;
+            ao.slot = big_entities.size();
+            big_entities.push_back({entity, position, ao.range});
+        } else {
+            auto& list = small_entities[cell];
+            ao.state = AvoidObject::InternalState::SmallEntity;
+            ao.cell = cell;
+            ao.slot = list.size();
+            list.push_back({entity, position, ao.range});
+        }
     }
 }
 
@@ -157,116 +211,64 @@ bool PathPlanner::checkToAvoid(glm::vec2 start, glm::vec2 end, glm::vec2& new_po
     if (startEndLength < 100.0f)
         return false;
     float firstAvoidF = startEndLength;
-    sp::ecs::Entity avoidObject;
+    glm::vec2 firstAvoidPosition{};
+    float firstAvoidRange = 0.0f;
     glm::vec2 firstAvoidQ{};
 
-    for(auto e : path_finding_system->big_entities)
+    auto check = [&](const PathFindingSystem::Entry& entry)
     {
-        auto ao = e.getComponent<AvoidObject>();
-        auto transform = e.getComponent<sp::Transform>();
-        if (ao && transform)
+        float f = glm::dot(startEndDiff, entry.position - start) / startEndLength;
+        if (f > 0 && f < startEndLength - entry.range)
         {
-            auto position = transform->getPosition();
-            float f = glm::dot(startEndDiff, position - start) / startEndLength;
-            if (f > 0 && f < startEndLength - ao->range)
+            glm::vec2 q = start + startEndDiff / startEndLength * f;
+            if (glm::length2(q - entry.position) < (entry.range + my_size) * (entry.range + my_size))
             {
-                glm::vec2 q = start + startEndDiff / startEndLength * f;
-                if (glm::length2(q - position) < (ao->range + my_size) * (ao->range + my_size))
+                if (f < firstAvoidF)
                 {
-                    if (f < firstAvoidF)
-                    {
-                        avoidObject = e;
-                        firstAvoidF = f;
-                        firstAvoidQ = q;
-                    }
+                    firstAvoidF = f;
+                    firstAvoidQ = q;
+                    firstAvoidPosition = entry.position;
+                    firstAvoidRange = entry.range;
                 }
             }
         }
-    }
+    };
 
-    {
-        // Bresenham's line algorithm to
-        int x1 = std::floor(start.x / small_object_grid_size);
-        int y1 = std::floor(start.y / small_object_grid_size);
-        int x2 = std::floor(end.x / small_object_grid_size);
-        int y2 = std::floor(end.y / small_object_grid_size);
-
-        const bool steep = abs(y2 - y1) > abs(x2 - x1);
-        if(steep)
-        {
-            std::swap(x1, y1);
-            std::swap(x2, y2);
-        }
+    for(auto& entry : path_finding_system->big_entities)
+        check(entry);
 
-        if(x1 > x2)
-        {
-            std::swap(x1, x2);
-            std::swap(y1, y2);
-        }
-
-        const int dx = x2 - x1;
-        const int dy = abs(y2 - y1);
-
-        int error = dx / 2;
-        const int ystep = (y1 < y2) ? 1 : -1;
-        int y = y1;
-
-        for(int x=x1; x<=x2; x++)
+    {
+        // Only check the cells of which the center is close enough to the line that an object in that cell could be in our way.
+        float margin = small_object_max_size + my_size + small_object_grid_size * 0.7072f;
+        int x0 = cellCoord(std::min(start.x, end.x) - margin);
+        int x1 = cellCoord(std::max(start.x, end.x) + margin);
+        int y0 = cellCoord(std::min(start.y, end.y) - margin);
+        int y1 = cellCoord(std::max(start.y, end.y) + margin);
+        for(int x=x0; x<=x1; x++)
         {
-            uint32_t hash;
-            if(steep)
-            {
-                hash = hashPosition({y * small_object_grid_size, x * small_object_grid_size});
-            }
-            else
+            for(int y=y0; y<=y1; y++)
             {
-                hash = hashPosition({x * small_object_grid_size, y * small_object_grid_size});
-            }
-
-            for(auto e : path_finding_system->small_entities[hash])
-            {
-                auto ao = e.getComponent<AvoidObject>();
-                auto transform = e.getComponent<sp::Transform>();
-                if (ao && transform)
-                {
-                    glm::vec2 position = transform->getPosition();
-                    float f = glm::dot(startEndDiff, position - start) / startEndLength;
-                    if (f > 0 && f < startEndLength - ao->range)
-                    {
-                        glm::vec2 q = start + startEndDiff / startEndLength * f;
-                        if (glm::length2(q - position) < (ao->range + my_size) * (ao->range + my_size))
-                        {
-                            if (f < firstAvoidF)
-                            {
-                                avoidObject = e;
-                                firstAvoidF = f;
-                                firstAvoidQ = q;
-                            }
-                        }
-                    }
-                }
-            }
-
-            error -= dy;
-            if(error < 0)
-            {
-                y += ystep;
-                error += dx;
+                glm::vec2 center{(float(x) + 0.5f) * small_object_grid_size, (float(y) + 0.5f) * small_object_grid_size};
+                float f = std::clamp(glm::dot(startEndDiff, center - start) / startEndLength, 0.0f, startEndLength);
+                if (glm::length2(start + startEndDiff / startEndLength * f - center) > margin * margin)
+                    continue;
+                auto it = path_finding_system->small_entities.find(cellKey(x, y));
+                if (it == path_finding_system->small_entities.end())
+                    continue;
+                for(auto& entry : it->second)
+                    check(entry);
             }
         }
     }
 
     if (firstAvoidF < startEndLength)
     {
-        auto ao = avoidObject.getComponent<AvoidObject>();
-        auto transform = avoidObject.getComponent<sp::Transform>();
-
-        glm::vec2 position = transform->getPosition();
+        glm::vec2 position = firstAvoidPosition;
         if (firstAvoidQ.x == position.x && firstAvoidQ.y == position.y)
             firstAvoidQ.x += 0.1f;
-        new_point = position + glm::normalize(firstAvoidQ - position) * (ao->range * 1.1f + my_size);
+        new_point = position + glm::normalize(firstAvoidQ - position) * (firstAvoidRange * 1.1f + my_size);
         if (alt_point)
-            *alt_point = position - glm::normalize(firstAvoidQ - position) * (ao->range * 1.1f + my_size);
+            *alt_point = position - glm::normalize(firstAvoidQ - position) * (firstAvoidRange * 1.1f + my_size);
         return true;
     }
     return false;
@@ -2,6 +2,8 @@
 
 #include "ecs/system.h"
 #include "ecs/entity.h"
+#include "components/avoidobject.h"
+#include <glm/vec2.hpp>
 #include <vector>
 #include <unordered_map>
 
@@ -13,8 +15,18 @@ public:
     void update(float delta) override;
 
 private:
-    std::vector<sp::ecs::Entity> big_entities;
-    std::unordered_map<uint32_t, std::vector<sp::ecs::Entity> > small_entities;
+    // Position and range are cached here, so the path planner does not need to look up components.
+    struct Entry {
+        sp::ecs::Entity entity;
+        glm::vec2 position;
+        float range;
+    };
+    // Big entities are always checked, small entities are stored in a grid of cells,
+    //  and only the cells near a planned line are checked.
+    std::vector<Entry> big_entities;
+    std::unordered_map<uint64_t, std::vector<Entry>> small_entities;
+
+    static void removeFromList(std::vector<Entry>& list, uint32_t slot, AvoidObject::InternalState state, uint64_t cell);
 
     friend class PathPlanner;
 };
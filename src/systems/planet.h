@@ -4,7 +4,7 @@
 #include "systems/radar.h"
 
 
-class PlanetRenderSystem : public sp::ecs::System, public Render3DInterface<PlanetRender, false>, public RenderRadarInterface<PlanetRender, 11, RadarRenderSystem::FlagNone>
+class PlanetRenderSystem : public sp::ecs::System, public Render3DInterface<PlanetRender, false>, public RenderRadarInterface<PlanetRender, 11, RadarRenderSystem::FlagNone, false>
 {
 public:
     void update(float delta) override;
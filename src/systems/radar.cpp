@@ -3,14 +3,112 @@
 #include "main.h"
 #include "components/faction.h"
 #include "components/scanning.h"
+#include "components/beamweapon.h"
+#include <glm/gtx/norm.hpp>
+#include <algorithm>
 
 int RadarRenderSystem::current_flags;
 float RadarRenderSystem::current_scale;
 float RadarRenderSystem::current_rotation_offset;
 glm::vec2 RadarRenderSystem::radar_screen_center;
 glm::vec2 RadarRenderSystem::view_position;
-sp::Bitset RadarRenderSystem::visible_objects;
+const sp::Bitset* RadarRenderSystem::visible_objects;
 std::vector<RadarRenderSystem::Handler> RadarRenderSystem::handlers;
+bool RadarRenderSystem::index_valid = false;
+std::unordered_map<uint64_t, std::vector<RadarRenderSystem::IndexEntry>> RadarRenderSystem::cells;
+std::vector<RadarRenderSystem::IndexEntry> RadarRenderSystem::large_entries;
+std::vector<RadarRenderSystem::Candidate> RadarRenderSystem::candidates;
+
+
+void RadarRenderSystem::render(sp::RenderTarget& renderer, glm::vec2 _radar_screen_center, float scale, glm::vec2 _view_position, float view_rotation, float view_radius, int flags, const sp::Bitset* _visible_objects)
+{
+    radar_screen_center = _radar_screen_center;
+    current_scale = scale;
+    current_rotation_offset = -view_rotation;
+    current_flags = flags;
+    view_position = _view_position;
+    visible_objects = _visible_objects;
+
+    if (!index_valid)
+        buildIndex();
+    gatherCandidates(view_radius);
+
+    for(auto& handler : handlers) {
+        if ((handler.flags & flags) == handler.flags)
+            handler.func(renderer, handler.rrif);
+    }
+    visible_objects = nullptr;
+}
+
+void RadarRenderSystem::buildIndex()
+{
+    for(auto& it : cells)
+        it.second.clear();
+    large_entries.clear();
+    for(auto [entity, transform] : sp::ecs::Query<sp::Transform>()) {
+        auto trace = entity.getComponent<RadarTrace>();
+        IndexEntry entry{entity, transform.getPosition(), trace ? trace->radius : 0.0f};
+        // Beam arcs are drawn out to the range of the beams, which can reach further than the margin.
+        if (auto beams = entity.getComponent<BeamWeaponSys>())
+            for(auto& mount : beams->mounts)
+                entry.extent = std::max(entry.extent, mount.range);
+        if (entry.extent > cull_margin)
+            large_entries.push_back(entry);
+        else
+            cells[cellKey(cellCoord(entry.position.x), cellCoord(entry.position.y))].push_back(entry);
+    }
+    index_valid = true;
+}
+
+void RadarRenderSystem::gatherCandidates(float view_radius)
+{
+    candidates.clear();
+
+    // The view can be rotated, so use the circle around the view instead of the view rectangle.
+    float range = view_radius + cull_margin;
+    int x0 = cellCoord(view_position.x - range);
+    int x1 = cellCoord(view_position.x + range);
+    int y0 = cellCoord(view_position.y - range);
+    int y1 = cellCoord(view_position.y + range);
+    if ((int64_t(x1) - x0 + 1) * (int64_t(y1) - y0 + 1) > int64_t(cells.size())) {
+        // Zoomed out further than the populated part of the map, checking the cells one by one would be slower.
+        for(auto& it : cells)
+            for(auto& entry : it.second)
+                if (glm::length2(entry.position - view_position) <= range * range)
+                    addCandidate(entry);
+    } else {
+        for(int x=x0; x<=x1; x++) {
+            for(int y=y0; y<=y1; y++) {
+                auto it = cells.find(cellKey(x, y));
+                if (it == cells.end())
+                    continue;
+                for(auto& entry : it->second)
+                    if (glm::length2(entry.position - view_position) <= range * range)
+                        addCandidate(entry);
+            }
+        }
+    }
+    for(auto& entry : large_entries) {
+        float r = view_radius + entry.extent;
+        if (glm::length2(entry.position - view_position) <= r * r)
+            addCandidate(entry);
+    }
+
+    // Keep the drawing order independent of the cell layout, so overlapping objects do not flicker while moving.
+    std::sort(candidates.begin(), candidates.end(), [](const Candidate& a, const Candidate& b) {
+        return a.entity.getIndex() < b.entity.getIndex();
+    });
+}
+
+void RadarRenderSystem::addCandidate(const IndexEntry& entry)
+{
+    if (visible_objects && !visible_objects->has(entry.entity.getIndex()))
+        return;
+    // The entity could have been destroyed since the index was build.
+    auto transform = entry.entity.getComponent<sp::Transform>();
+    if (transform)
+        candidates.push_back({entry.entity, transform});
+}
 
 
 void BasicRadarRendering::renderOnRadar(sp::RenderTarget& renderer, sp::ecs::Entity entity, glm::vec2 screen_position, float scale, float rotation, RadarTrace& trace)
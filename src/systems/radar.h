@@ -5,10 +5,15 @@
 #include <container/bitset.h>
 #include <vectorUtils.h>
 #include <graphics/renderTarget.h>
+#include <unordered_map>
+#include <cmath>
 #include "components/collision.h"
+#include "profiler.h"
 
 
-template<typename T, int PRIO, int FLAGS> class RenderRadarInterface {
+// Handlers with CULL set are only called for entities near the radar view. Disable it for components that draw
+//  far away from the position of their entity, like zones and range circles.
+template<typename T, int PRIO, int FLAGS, bool CULL=true> class RenderRadarInterface {
 public:
     RenderRadarInterface();
     virtual void renderOnRadar(sp::RenderTarget& renderer, sp::ecs::Entity e, glm::vec2 screen_position, float scale, float rotation, T& component) = 0;
@@ -16,16 +21,24 @@ public:
 
 class RadarRenderSystem {
 public:
-    template<typename T, int PRIO, int FLAGS> static void addHandler(RenderRadarInterface<T, PRIO, FLAGS>* rrif) {
+    template<typename T, int PRIO, int FLAGS, bool CULL> static void addHandler(RenderRadarInterface<T, PRIO, FLAGS, CULL>* rrif) {
         handlers.push_back({
             PRIO, FLAGS, rrif, [](sp::RenderTarget& renderer, void* interface) {
-                auto rr = reinterpret_cast<RenderRadarInterface<T, PRIO, FLAGS>*>(interface);
-                for(auto [entity, component, transform] : sp::ecs::Query<T, sp::Transform>()) {
-                    if (!visible_objects.has(entity.getIndex())) continue;
-
-                    auto radar_position = rotateVec2((transform.getPosition() - view_position) * current_scale, current_rotation_offset);
-                    radar_position += radar_screen_center;
-                    rr->renderOnRadar(renderer, entity, radar_position, current_scale, transform.getRotation() + current_rotation_offset, component);
+                static const char* profile_name = Profiler::intern("Radar " + Profiler::typeName(typeid(T)));
+                Profiler::Scope scope(profile_name);
+                auto rr = reinterpret_cast<RenderRadarInterface<T, PRIO, FLAGS, CULL>*>(interface);
+                if constexpr (CULL) {
+                    // Candidates are already filtered on visibility.
+                    for(auto& candidate : candidates) {
+                        auto component = candidate.entity.getComponent<T>();
+                        if (component)
+                            renderEntity(renderer, rr, candidate.entity, *candidate.transform, *component);
+                    }
+                } else {
+                    for(auto [entity, component, transform] : sp::ecs::Query<T, sp::Transform>()) {
+                        if (visible_objects && !visible_objects->has(entity.getIndex())) continue;
+                        renderEntity(renderer, rr, entity, transform, component);
+                    }
                 }
             }
         });
@@ -34,20 +47,12 @@ public:
         });
     }
 
-    static void render(sp::RenderTarget& renderer, glm::vec2 _radar_screen_center, float scale, glm::vec2 _view_position, float view_rotation, int flags, sp::Bitset _visible_objects) {
-        radar_screen_center = _radar_screen_center;
-        current_scale = scale;
-        current_rotation_offset = -view_rotation;
-        current_flags = flags;
-        view_position = _view_position;
-        visible_objects = _visible_objects;
-
-
-        for(auto& handler : handlers) {
-            if ((handler.flags & flags) == handler.flags)
-                handler.func(renderer, handler.rrif);
-        }
-    }
+    // Render all handlers for a single radar view.
+    //  view_radius is the distance from the view position to the furthest visible point of the view, in world units.
+    //  visible_objects can be nullptr if everything is visible.
+    static void render(sp::RenderTarget& renderer, glm::vec2 radar_screen_center, float scale, glm::vec2 view_position, float view_rotation, float view_radius, int flags, const sp::Bitset* visible_objects);
+    // Called once per frame, entities are moved into the right cell of the spatial index on the next render.
+    static void invalidateIndex() { index_valid = false; }
 
     static constexpr int FlagNone = 0x00;
     static constexpr int FlagLongRange = 0x01;
@@ -55,11 +60,15 @@ public:
     static constexpr int FlagGM = 0x04;
     static int current_flags;
 private:
+    // Entities further than this from the view are never drawn by culled handlers, unless their radar trace or beam range is larger.
+    static constexpr float cull_margin = 5000.0f;
+    static constexpr float cell_size = cull_margin;
+
     static float current_scale;
     static float current_rotation_offset;
     static glm::vec2 radar_screen_center;
     static glm::vec2 view_position;
-    static sp::Bitset visible_objects;
+    static const sp::Bitset* visible_objects;
     struct Handler {
         int priority;
         int flags;
@@ -67,9 +76,36 @@ private:
         void(*func)(sp::RenderTarget&, void*);
     };
     static std::vector<Handler> handlers;
+
+    // Spatial index of all entities with a transform, shared by all radar views and build at most once per frame.
+    struct IndexEntry {
+        sp::ecs::Entity entity;
+        glm::vec2 position;
+        float extent;
+    };
+    struct Candidate {
+        sp::ecs::Entity entity;
+        sp::Transform* transform;
+    };
+    static bool index_valid;
+    static std::unordered_map<uint64_t, std::vector<IndexEntry>> cells;
+    static std::vector<IndexEntry> large_entries;
+    static std::vector<Candidate> candidates;
+
+    static void buildIndex();
+    static void gatherCandidates(float view_radius);
+    static void addCandidate(const IndexEntry& entry);
+    static uint64_t cellKey(int x, int y) { return (uint64_t(uint32_t(x)) << 32) | uint64_t(uint32_t(y)); }
+    static int cellCoord(float f) { return int(std::floor(f / cell_size)); }
+
+    template<typename T, typename RR> static void renderEntity(sp::RenderTarget& renderer, RR* rr, sp::ecs::Entity entity, sp::Transform& transform, T& component) {
+        auto radar_position = rotateVec2((transform.getPosition() - view_position) * current_scale, current_rotation_offset);
+        radar_position += radar_screen_center;
+        rr->renderOnRadar(renderer, entity, radar_position, current_scale, transform.getRotation() + current_rotation_offset, component);
+    }
 };
 
-template<typename T, int PRIO, int FLAGS> RenderRadarInterface<T, PRIO, FLAGS>::RenderRadarInterface() { RadarRenderSystem::addHandler(this); }
+template<typename T, int PRIO, int FLAGS, bool CULL> RenderRadarInterface<T, PRIO, FLAGS, CULL>::RenderRadarInterface() { RadarRenderSystem::addHandler(this); }
 
 #include "components/radar.h"
 #include "components/name.h"
@@ -78,7 +114,7 @@ class BasicRadarRendering :
     public RenderRadarInterface<RadarTrace, 50, RadarRenderSystem::FlagNone>,
     public RenderRadarInterface<CallSign, 100, RadarRenderSystem::FlagNone> {
 public:
-    void update(float delta) override {}
+    void update(float delta) override { RadarRenderSystem::invalidateIndex(); }
 
     void renderOnRadar(sp::RenderTarget& renderer, sp::ecs::Entity e, glm::vec2 screen_position, float scale, float rotation, RadarTrace& component) override;
     void renderOnRadar(sp::RenderTarget& renderer, sp::ecs::Entity e, glm::vec2 screen_position, float scale, float rotation, CallSign& component) override;
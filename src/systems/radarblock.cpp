@@ -2,19 +2,94 @@
 #include "components/radarblock.h"
 #include "components/collision.h"
 #include "ecs/query.h"
+#include "vectorUtils.h"
 #include <glm/gtx/norm.hpp>
+#include <array>
 
 
+std::vector<RadarBlockSystem::Blocker> RadarBlockSystem::blockers;
+std::unordered_map<uint64_t, std::vector<uint32_t>> RadarBlockSystem::cells;
+bool RadarBlockSystem::index_valid = false;
+
+
+void RadarBlockSystem::update(float delta)
+{
+    updateIndex();
+}
+
 void RadarBlockSystem::renderOnRadar(sp::RenderTarget& renderer, sp::ecs::Entity e, glm::vec2 screen_position, float scale, float rotation, RadarBlock& component)
 {
     renderer.drawCircleOutline(screen_position, component.range * scale, 2.0, glm::u8vec4(255, 255, 255, 64));
 }
 
-bool RadarBlockSystem::inRadarBlock(glm::vec2 position)
+void RadarBlockSystem::updateIndex()
 {
+    // Radar blockers are usually nebulae that never move, so only rebuild the grid when something changed.
+    bool changed = !index_valid;
+    size_t count = 0;
     for(auto [entity, block, transform] : sp::ecs::Query<RadarBlock, sp::Transform>())
     {
-        if (glm::length2(position - transform.getPosition()) < block.range*block.range)
+        Blocker blocker{transform.getPosition(), block.range, block.behind};
+        if (count >= blockers.size() || blockers[count] != blocker)
+        {
+            changed = true;
+            if (count >= blockers.size())
+                blockers.push_back(blocker);
+            else
+                blockers[count] = blocker;
+        }
+        count++;
+    }
+    if (count != blockers.size())
+    {
+        changed = true;
+        blockers.resize(count);
+    }
+    index_valid = true;
+    if (!changed)
+        return;
+
+    for(auto& it : cells)
+        it.second.clear();
+    for(uint32_t index=0; index<blockers.size(); index++)
+    {
+        auto& blocker = blockers[index];
+        int x0 = cellCoord(blocker.position.x - blocker.range);
+        int x1 = cellCoord(blocker.position.x + blocker.range);
+        int y0 = cellCoord(blocker.position.y - blocker.range);
+        int y1 = cellCoord(blocker.position.y + blocker.range);
+        for(int x=x0; x<=x1; x++)
+            for(int y=y0; y<=y1; y++)
+                cells[cellKey(x, y)].push_back(index);
+    }
+}
+
+bool RadarBlockSystem::blocks(const Blocker& blocker, glm::vec2 source, glm::vec2 diff, float length)
+{
+    if (blocker.behind) {
+        //Calculate point q, which is a point on the line start-end that is closest to the center of the blocker
+        float f = glm::dot(diff, blocker.position - source) / length;
+        if (f < 0.0f)
+            f = 0.0f;
+        if (f > length)
+            f = length;
+        auto q = source + diff / length * f;
+        return glm::length2(q - blocker.position) < blocker.range * blocker.range;
+    }
+    return glm::length2(source - blocker.position) < blocker.range * blocker.range;
+}
+
+bool RadarBlockSystem::inRadarBlock(glm::vec2 position)
+{
+    if (!index_valid)
+        updateIndex();
+    auto it = cells.find(cellKey(cellCoord(position.x), cellCoord(position.y)));
+    if (it == cells.end())
+        return false;
+    for(auto index : it->second)
+    {
+        auto& blocker = blockers[index];
+        if (glm::length2(position - blocker.position) < blocker.range * blocker.range)
             return true;
     }
     return false;
@@ -25,28 +100,117 @@ bool RadarBlockSystem::isRadarBlockedFrom(glm::vec2 source, sp::ecs::Entity enti
     if (entity.hasComponent<NeverRadarBlocked>()) return false;
     auto et = entity.getComponent<sp::Transform>();
     if (!et) return false;
+    return isRadarBlockedBetween(source, et->getPosition(), short_range);
+}
 
-    auto startEndDiff = et->getPosition() - source;
+bool RadarBlockSystem::isRadarBlockedBetween(glm::vec2 source, glm::vec2 target, float short_range)
+{
+    auto startEndDiff = target - source;
     float startEndLength = glm::length(startEndDiff);
     if (startEndLength < short_range)
         return false;
 
-    for(auto [entity, block, transform] : sp::ecs::Query<RadarBlock, sp::Transform>())
+    if (!index_valid)
+        updateIndex();
+    if (blockers.empty())
+        return false;
+
+    // Walk trough all the grid cells that the line from source to target passes. Any blocker that intersects
+    //  the line is in at least one of those cells, and a blocker that contains the source is in the first one.
+    int x = cellCoord(source.x);
+    int y = cellCoord(source.y);
+    int end_x = cellCoord(target.x);
+    int end_y = cellCoord(target.y);
+    int step_x = startEndDiff.x < 0.0f ? -1 : 1;
+    int step_y = startEndDiff.y < 0.0f ? -1 : 1;
+    float delta_x = startEndDiff.x != 0.0f ? cell_size / std::abs(startEndDiff.x) : std::numeric_limits<float>::infinity();
+    float delta_y = startEndDiff.y != 0.0f ? cell_size / std::abs(startEndDiff.y) : std::numeric_limits<float>::infinity();
+    float next_x = startEndDiff.x != 0.0f ? ((step_x > 0 ? float(x + 1) * cell_size : float(x) * cell_size) - source.x) / startEndDiff.x : std::numeric_limits<float>::infinity();
+    float next_y = startEndDiff.y != 0.0f ? ((step_y > 0 ? float(y + 1) * cell_size : float(y) * cell_size) - source.y) / startEndDiff.y : std::numeric_limits<float>::infinity();
+    int cell_count = std::abs(end_x - x) + std::abs(end_y - y) + 1;
+    for(int n=0; n<cell_count; n++)
     {
-        if (block.behind) {
-            //Calculate point q, which is a point on the line start-end that is closest to n->getPosition
-            float f = glm::dot(startEndDiff, transform.getPosition() - source) / startEndLength;
-            if (f < 0.0f)
-                f = 0.0f;
-            if (f > startEndLength)
-                f = startEndLength;
-            auto q = source + startEndDiff / startEndLength * f;
-            if (glm::length2(q - transform.getPosition()) < block.range*block.range)
-                return true;
-        } else {
-            if (glm::length2(source - transform.getPosition()) < block.range*block.range)
-                return true;
+        auto it = cells.find(cellKey(x, y));
+        if (it != cells.end())
+        {
+            for(auto index : it->second)
+            {
+                if (blocks(blockers[index], source, startEndDiff, startEndLength))
+                    return true;
+            }
+        }
+        if (next_x < next_y)
+        {
+            next_x += delta_x;
+            x += step_x;
+        }
+        else
+        {
+            next_y += delta_y;
+            y += step_y;
         }
     }
     return false;
 }
+
+void RadarBlockSystem::setVisibleFrom(glm::vec2 source, float short_range, sp::Bitset& visible)
+{
+    if (!index_valid)
+        updateIndex();
+
+    // Seen from the source, every blocker covers a cone of directions. Put the blockers in angle sectors,
+    //  so every entity only needs to check the blockers in the direction it is in.
+    constexpr int sector_count = 64;
+    constexpr float sector_size = 360.0f / float(sector_count);
+    std::array<std::vector<uint32_t>, sector_count> sectors;
+    bool source_blocked = false;
+    for(uint32_t index=0; index<blockers.size(); index++)
+    {
+        auto& blocker = blockers[index];
+        auto diff = blocker.position - source;
+        float distance = glm::length(diff);
+        if (distance < blocker.range)
+        {
+            // The source is inside a blocker, so everything outside of short range is blocked.
+            source_blocked = true;
+            break;
+        }
+        if (!blocker.behind)
+            continue;
+        float half_angle = glm::degrees(std::asin(blocker.range / distance));
+        float angle = vec2ToAngle(diff);
+        int start = int(std::floor((angle - half_angle) / sector_size));
+        int end = int(std::floor((angle + half_angle) / sector_size));
+        for(int sector=start; sector<=end; sector++)
+            sectors[((sector % sector_count) + sector_count) % sector_count].push_back(index);
+    }
+
+    float short_range_sq = short_range * short_range;
+    for(auto [entity, transform] : sp::ecs::Query<sp::Transform>())
+    {
+        auto diff = transform.getPosition() - source;
+        float length_sq = glm::length2(diff);
+        if (length_sq < short_range_sq || entity.hasComponent<NeverRadarBlocked>())
+        {
+            visible.set(entity.getIndex());
+            continue;
+        }
+        if (source_blocked)
+            continue;
+
+        float length = std::sqrt(length_sq);
+        int sector = int(std::floor(vec2ToAngle(diff) / sector_size));
+        sector = ((sector % sector_count) + sector_count) % sector_count;
+        bool blocked = false;
+        for(auto index : sectors[sector])
+        {
+            if (blocks(blockers[index], source, diff, length))
+            {
+                blocked = true;
+                break;
+            }
+        }
+        if (!blocked)
+            visible.set(entity.getIndex());
+    }
+}
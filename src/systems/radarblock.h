@@ -2,16 +2,46 @@
 
 #include <glm/vec2.hpp>
 #include <ecs/entity.h>
+#include <container/bitset.h>
+#include <unordered_map>
 #include "components/radarblock.h"
 #include "systems/radar.h"
 
 
-class RadarBlockSystem : public sp::ecs::System, public RenderRadarInterface<RadarBlock, 11, RadarRenderSystem::FlagGM>
+class RadarBlockSystem : public sp::ecs::System, public RenderRadarInterface<RadarBlock, 11, RadarRenderSystem::FlagGM, false>
 {
 public:
-    void update(float delta) override {}
+    void update(float delta) override;
 
     void renderOnRadar(sp::RenderTarget& renderer, sp::ecs::Entity e, glm::vec2 screen_position, float scale, float rotation, RadarBlock& component) override;
     static bool inRadarBlock(glm::vec2 position);
     static bool isRadarBlockedFrom(glm::vec2 source, sp::ecs::Entity entity, float short_range);
-};
\ No newline at end of file
+    // Same as isRadarBlockedFrom, but for a target position, ignoring NeverRadarBlocked.
+    static bool isRadarBlockedBetween(glm::vec2 source, glm::vec2 target, float short_range);
+    // Same as calling isRadarBlockedFrom for every entity with a transform, but only does the per blocker work once.
+    //  Sets every entity that is not radar blocked from the source in the visible bitset.
+    static void setVisibleFrom(glm::vec2 source, float short_range, sp::Bitset& visible);
+    // Rebuild the grid if needed. The queries only read from the grid after this, so they can be used from
+    //  multiple threads as long as no blockers are changed in the mean time.
+    static void updateIndex();
+
+private:
+    // All radar blockers are stored in a uniform grid. A blocker is added to every cell its range overlaps,
+    //  so a line only needs to check the blockers in the cells it passes trough.
+    // The grid is only rebuild when a blocker is added, removed, moved or resized.
+    struct Blocker {
+        glm::vec2 position;
+        float range;
+        bool behind;
+
+        bool operator!=(const Blocker& other) const { return position != other.position || range != other.range || behind != other.behind; }
+    };
+    static constexpr float cell_size = 10000.0f;
+    static std::vector<Blocker> blockers;
+    static std::unordered_map<uint64_t, std::vector<uint32_t>> cells;
+    static bool index_valid;
+
+    static bool blocks(const Blocker& blocker, glm::vec2 source, glm::vec2 diff, float length);
+    static uint64_t cellKey(int x, int y) { return (uint64_t(uint32_t(x)) << 32) | uint64_t(uint32_t(y)); }
+    static int cellCoord(float f) { return int(std::floor(f / cell_size)); }
+};
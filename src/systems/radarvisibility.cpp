@@ -0,0 +1,210 @@
+#include "systems/radarvisibility.h"
+#include "systems/radarblock.h"
+#include "components/collision.h"
+#include "components/faction.h"
+#include "components/radar.h"
+#include "ecs/query.h"
+#include <glm/gtx/norm.hpp>
+
+
+std::unordered_map<int, RadarVisibilitySystem::FriendlySet> RadarVisibilitySystem::friendly_sets;
+std::unordered_map<uint32_t, RadarVisibilitySystem::NebulaSet> RadarVisibilitySystem::nebula_sets;
+
+
+void RadarVisibilitySystem::update(float delta)
+{
+    for(auto it = friendly_sets.begin(); it != friendly_sets.end(); )
+    {
+        if (!it->second.used)
+        {
+            it = friendly_sets.erase(it);
+            continue;
+        }
+        it->second.used = false;
+        it->second.valid = false;
+        ++it;
+    }
+    for(auto it = nebula_sets.begin(); it != nebula_sets.end(); )
+    {
+        if (!it->second.used)
+        {
+            it = nebula_sets.erase(it);
+            continue;
+        }
+        it->second.used = false;
+        it->second.valid = false;
+        ++it;
+    }
+}
+
+const sp::Bitset& RadarVisibilitySystem::getFriendlyShortRangeVisible(sp::ecs::Entity ship)
+{
+    return getFriendlySet(ship).visible;
+}
+
+const sp::Bitset& RadarVisibilitySystem::getNebulaVisible(sp::ecs::Entity ship)
+{
+    auto& set = nebula_sets[ship.getIndex()];
+    set.used = true;
+    if (set.ship != ship)
+    {
+        set.ship = ship;
+        set.valid = false;
+    }
+    if (!set.valid)
+    {
+        set.valid = true;
+        set.visible = sp::Bitset();
+        if (auto transform = ship.getComponent<sp::Transform>())
+        {
+            auto lrr = ship.getComponent<LongRangeRadar>();
+            auto short_range = lrr ? lrr->short_range : 5000.0f;
+            RadarBlockSystem::setVisibleFrom(transform->getPosition(), short_range, set.visible);
+        }
+    }
+    return set.visible;
+}
+
+bool RadarVisibilitySystem::isInFriendlyShortRange(sp::ecs::Entity ship, glm::vec2 position)
+{
+    return inSourceRange(getFriendlySet(ship), position, 0.0f);
+}
+
+RadarVisibilitySystem::FriendlySet& RadarVisibilitySystem::getFriendlySet(sp::ecs::Entity ship)
+{
+    Faction::updateRelationMatrix();
+    auto faction_index = Faction::getRelationIndex(ship);
+    auto& set = friendly_sets[faction_index];
+    set.used = true;
+    if (!set.valid)
+    {
+        updateFriendlySet(set, faction_index);
+        set.valid = true;
+    }
+    return set;
+}
+
+void RadarVisibilitySystem::updateFriendlySet(FriendlySet& set, int faction_index)
+{
+    std::vector<Source> sources;
+    for(auto [entity, ssrr, transform] : sp::ecs::Query<ShareShortRangeRadar, sp::Transform>())
+    {
+        if (Faction::getRelationByIndex(faction_index, Faction::getRelationIndex(entity)) != FactionRelation::Friendly)
+            continue;
+        // Entities without a radar reveal 5U around them.
+        auto lrr = entity.getComponent<LongRangeRadar>();
+        sources.push_back({transform.getPosition(), lrr ? lrr->short_range : 5000.0f});
+    }
+
+    // Only the area around sources that changed needs to be checked again, most entities did not move or
+    //  are far away from any friendly ship.
+    set.dirty_cells.clear();
+    bool changed = sources.size() != set.sources.size();
+    for(size_t n=0; n<std::max(sources.size(), set.sources.size()); n++)
+    {
+        if (n < sources.size() && n < set.sources.size() && !(sources[n] != set.sources[n]))
+            continue;
+        if (n < sources.size())
+            markCells(set, sources[n]);
+        if (n < set.sources.size())
+            markCells(set, set.sources[n]);
+        changed = true;
+    }
+    if (changed)
+    {
+        set.sources = std::move(sources);
+        for(auto& it : set.cells)
+            it.second.clear();
+        for(uint32_t index=0; index<set.sources.size(); index++)
+        {
+            auto& source = set.sources[index];
+            int x0 = cellCoord(source.position.x - source.range);
+            int x1 = cellCoord(source.position.x + source.range);
+            int y0 = cellCoord(source.position.y - source.range);
+            int y1 = cellCoord(source.position.y + source.range);
+            for(int x=x0; x<=x1; x++)
+                for(int y=y0; y<=y1; y++)
+                    set.cells[cellKey(x, y)].push_back(index);
+        }
+    }
+
+    set.visible = sp::Bitset();
+    for(auto [entity, transform] : sp::ecs::Query<sp::Transform>())
+    {
+        // If the object can't hide in a nebula, it's considered visible.
+        if (entity.hasComponent<NeverRadarBlocked>())
+        {
+            set.visible.set(entity.getIndex());
+            continue;
+        }
+
+        auto index = entity.getIndex();
+        if (index >= set.tracked.size())
+            set.tracked.resize(index + 1);
+        auto& tracked = set.tracked[index];
+        auto position = transform.getPosition();
+        auto trace = entity.getComponent<RadarTrace>();
+        auto radius = trace ? trace->radius : default_radius;
+        if (tracked.version != entity.getVersion() || tracked.position != position || tracked.radius != radius || inDirtyCell(set, position, radius))
+        {
+            tracked.version = entity.getVersion();
+            tracked.position = position;
+            tracked.radius = radius;
+            tracked.visible = inSourceRange(set, position, radius);
+        }
+        if (tracked.visible)
+            set.visible.set(index);
+    }
+}
+
+void RadarVisibilitySystem::markCells(FriendlySet& set, const Source& source)
+{
+    int x0 = cellCoord(source.position.x - source.range);
+    int x1 = cellCoord(source.position.x + source.range);
+    int y0 = cellCoord(source.position.y - source.range);
+    int y1 = cellCoord(source.position.y + source.range);
+    for(int x=x0; x<=x1; x++)
+        for(int y=y0; y<=y1; y++)
+            set.dirty_cells.insert(cellKey(x, y));
+}
+
+bool RadarVisibilitySystem::inDirtyCell(const FriendlySet& set, glm::vec2 position, float radius)
+{
+    if (set.dirty_cells.empty())
+        return false;
+    int x0 = cellCoord(position.x - radius);
+    int x1 = cellCoord(position.x + radius);
+    int y0 = cellCoord(position.y - radius);
+    int y1 = cellCoord(position.y + radius);
+    for(int x=x0; x<=x1; x++)
+        for(int y=y0; y<=y1; y++)
+            if (set.dirty_cells.find(cellKey(x, y)) != set.dirty_cells.end())
+                return true;
+    return false;
+}
+
+bool RadarVisibilitySystem::inSourceRange(const FriendlySet& set, glm::vec2 position, float radius)
+{
+    // Any source that overlaps the entity also overlaps a cell within the radius of the entity.
+    int x0 = cellCoord(position.x - radius);
+    int x1 = cellCoord(position.x + radius);
+    int y0 = cellCoord(position.y - radius);
+    int y1 = cellCoord(position.y + radius);
+    for(int x=x0; x<=x1; x++)
+    {
+        for(int y=y0; y<=y1; y++)
+        {
+            auto it = set.cells.find(cellKey(x, y));
+            if (it == set.cells.end())
+                continue;
+            for(auto index : it->second)
+            {
+                auto& source = set.sources[index];
+                float r = source.range + radius;
+                if (glm::length2(position - source.position) < r * r)
+                    return true;
+            }
+        }
+    }
+    return false;
+}
@@ -0,0 +1,82 @@
+#pragma once
+
+#include "ecs/system.h"
+#include "ecs/entity.h"
+#include "container/bitset.h"
+#include <glm/vec2.hpp>
+#include <vector>
+#include <unordered_map>
+#include <unordered_set>
+#include <cmath>
+
+
+// Computes which entities are visible on radar views that use fog of war.
+//  Every set is computed at most once per frame and shared by all radar views and screens that ask for it.
+//  Sets that nobody asked for during the last frame are dropped.
+class RadarVisibilitySystem : public sp::ecs::System
+{
+public:
+    void update(float delta) override;
+
+    // Entities (partially) within the short range radar of any entity that is friendly with the ship and shares its short range radar.
+    //  Entities that are never radar blocked are always visible.
+    static const sp::Bitset& getFriendlyShortRangeVisible(sp::ecs::Entity ship);
+    // Entities that are not hidden by radar blockers as seen from the ship.
+    static const sp::Bitset& getNebulaVisible(sp::ecs::Entity ship);
+    // Check if the position is within the short range radar of any entity that is friendly with the ship and shares its short range radar.
+    static bool isInFriendlyShortRange(sp::ecs::Entity ship, glm::vec2 position);
+
+private:
+    static constexpr float cell_size = 5000.0f;
+    // Radius used for entities without a radar trace.
+    static constexpr float default_radius = 300.0f;
+
+    struct Source
+    {
+        glm::vec2 position;
+        float range;
+
+        bool operator!=(const Source& other) const { return position != other.position || range != other.range; }
+    };
+    // Result of the last check of an entity, it only needs to be checked again if it moved or a source near it changed.
+    struct Tracked
+    {
+        uint32_t version = 0;
+        glm::vec2 position{};
+        float radius = -1.0f;
+        bool visible = false;
+    };
+    // Visibility trough friendly short range radar is the same for every ship of a faction, so these sets are per faction.
+    struct FriendlySet
+    {
+        bool valid = false;
+        bool used = false;
+        std::vector<Source> sources;
+        // Sources are added to every cell their range overlaps.
+        std::unordered_map<uint64_t, std::vector<uint32_t>> cells;
+        // Cells where a source was added, removed or changed since the previous update.
+        std::unordered_set<uint64_t> dirty_cells;
+        // Indexed by entity index.
+        std::vector<Tracked> tracked;
+        sp::Bitset visible;
+    };
+    // Visibility trough nebulae depends on the position of the ship, so these sets are per ship.
+    struct NebulaSet
+    {
+        bool valid = false;
+        bool used = false;
+        sp::ecs::Entity ship;
+        sp::Bitset visible;
+    };
+
+    static std::unordered_map<int, FriendlySet> friendly_sets;
+    static std::unordered_map<uint32_t, NebulaSet> nebula_sets;
+
+    static FriendlySet& getFriendlySet(sp::ecs::Entity ship);
+    static void updateFriendlySet(FriendlySet& set, int faction_index);
+    static void markCells(FriendlySet& set, const Source& source);
+    static bool inDirtyCell(const FriendlySet& set, glm::vec2 position, float radius);
+    static bool inSourceRange(const FriendlySet& set, glm::vec2 position, float radius);
+    static uint64_t cellKey(int x, int y) { return (uint64_t(uint32_t(x)) << 32) | uint64_t(uint32_t(y)); }
+    static int cellCoord(float f) { return int(std::floor(f / cell_size)); }
+};
@@ -7,12 +7,16 @@
 #include <glm/gtc/type_ptr.hpp>
 #include "tween.h"
 #include "random.h"
+#include <algorithm>
+#include <functional>
 
 
 std::vector<RenderSystem::RenderHandler> RenderSystem::render_handlers;
 
 void RenderSystem::render3D(float aspect, float camera_fov)
 {
+    Mesh::uploadLoaded();
+
     view_vector = vec2FromAngle(camera_yaw);
     depth_cutoff_back = camera_position.z * -tanf(glm::radians(90+camera_pitch + camera_fov/2.f));
     depth_cutoff_front = camera_position.z * -tanf(glm::radians(90+camera_pitch - camera_fov/2.f));
@@ -26,7 +30,18 @@ void RenderSystem::render3D(float aspect, float camera_fov)
     for(int n=render_lists.size() - 1; n >= 0; n--)
     {
         auto& render_list = render_lists[n];
-        std::sort(render_list.begin(), render_list.end(), [](const RenderEntry& a, const RenderEntry& b) { return a.depth > b.depth; });
+        // Opaque objects first, grouped on GL state and then front to back. Transparent objects back to front.
+        std::sort(render_list.begin(), render_list.end(), [](const RenderEntry& a, const RenderEntry& b) {
+            if (a.transparent != b.transparent)
+                return b.transparent;
+            if (a.transparent)
+                return a.depth > b.depth;
+            if (a.rif != b.rif)
+                return a.rif < b.rif;
+            if (a.sort_key != b.sort_key)
+                return a.sort_key < b.sort_key;
+            return a.depth < b.depth;
+        });
 
         auto projection = glm::perspective(glm::radians(camera_fov), aspect, 1.f, 25000.f * (n + 1));
         // Update projection matrix in shaders.
@@ -34,18 +49,37 @@ void RenderSystem::render3D(float aspect, float camera_fov)
 
         glDepthMask(true);
         glDisable(GL_BLEND);
+        void* active_rif = nullptr;
         for(auto info : render_list)
-            if (!info.transparent)
-                info.call_rif(info.rif, info.entity, *info.transform, info.component_ptr);
+        {
+            if (info.transparent)
+                break;
+            if (info.rif != active_rif)
+            {
+                flushHandler(active_rif);
+                active_rif = info.rif;
+            }
+            info.call_rif(info.rif, info.entity, *info.transform, info.component_ptr);
+        }
+        flushHandler(active_rif);
         glEnable(GL_BLEND);
         glBlendFunc(GL_ONE, GL_ONE);
         glDepthMask(false);
         for(auto info : render_list)
             if (info.transparent)
                 info.call_rif(info.rif, info.entity, *info.transform, info.component_ptr);
+        for(auto& handler : render_handlers)
+            handler.flush(handler.rif);
     }
 }
 
+void RenderSystem::flushHandler(void* rif)
+{
+    for(auto& handler : render_handlers)
+        if (handler.rif == rif)
+            handler.flush(handler.rif);
+}
+
 glm::mat4 calculateModelMatrix(glm::vec2 position, float rotation, glm::vec3 mesh_offset, float scale) {
     auto model_matrix = glm::translate(glm::identity<glm::mat4>(), glm::vec3{ position.x, position.y, 0.f });
     model_matrix = glm::rotate(model_matrix, glm::pi<float>(), glm::vec3{ 0.f, 0.f, 1.f });
@@ -56,7 +90,7 @@ glm::mat4 calculateModelMatrix(glm::vec2 position, float rotation, glm::vec3 mes
     return model_matrix;
 }
 
-ShaderRegistry::ScopedShader lookUpShader(MeshRenderComponent& mrc)
+ShaderRegistry::Shaders lookUpShaderId(MeshRenderComponent& mrc)
 {
     auto shader_id = ShaderRegistry::Shaders::Object;
     if (mrc.getTexture() && mrc.getSpecularTexture() && mrc.getIlluminationTexture())
@@ -65,8 +99,12 @@ ShaderRegistry::ScopedShader lookUpShader(MeshRenderComponent& mrc)
         shader_id = ShaderRegistry::Shaders::ObjectSpecular;
     else if (mrc.getTexture() && mrc.getIlluminationTexture())
         shader_id = ShaderRegistry::Shaders::ObjectIllumination;
+    return shader_id;
+}
 
-    return ShaderRegistry::ScopedShader(shader_id);
+ShaderRegistry::ScopedShader lookUpShader(MeshRenderComponent& mrc)
+{
+    return ShaderRegistry::ScopedShader(lookUpShaderId(mrc));
 }
 
 void activateAndBindMeshTextures(MeshRenderComponent& mrc)
@@ -106,27 +144,97 @@ void MeshRenderSystem::update(float delta)
 
 void MeshRenderSystem::render3D(sp::ecs::Entity e, sp::Transform& transform, MeshRenderComponent& mrc)
 {
+    auto mesh = mrc.getMesh();
+    // A mesh that failed to load is not drawn at all, the placeholder is only for meshes that are still loading.
+    if (!mesh || mesh->isFailed())
+        return;
+    if (!mesh->isReady())
+    {
+        // The mesh is still loading in the background, draw a sphere the size of the object in the mean time.
+        auto physics = e.getComponent<sp::Physics>();
+        auto sphere = Mesh::getMesh("mesh/sphere.obj");
+        if (!physics || !sphere)
+            return;
+        auto model_matrix = calculateModelMatrix(transform.getPosition(), transform.getRotation(), {}, physics->getSize().x);
+        draw(mrc, sphere, model_matrix, model_matrix);
+        return;
+    }
+
     auto model_matrix = calculateModelMatrix(
             transform.getPosition(),
             transform.getRotation(),
             mrc.mesh_offset,
             mrc.scale);
 
-    auto shader = lookUpShader(mrc);
-    glUniformMatrix4fv(shader.get().uniform(ShaderRegistry::Uniforms::Model), 1, GL_FALSE, glm::value_ptr(model_matrix));
-
     auto modeldata_matrix = glm::rotate(model_matrix, glm::radians(180.f), {0.f, 0.f, 1.f});
     modeldata_matrix = glm::scale(modeldata_matrix, glm::vec3{mrc.scale});
 
-    // Lights setup.
-    ShaderRegistry::setupLights(shader.get(), modeldata_matrix);
+    draw(mrc, mesh, model_matrix, modeldata_matrix);
+}
+
+uint64_t MeshRenderSystem::sortKey(sp::ecs::Entity e, MeshRenderComponent& mrc)
+{
+    // Shader in the top bits, then the textures, then the mesh. Hash collisions only make the grouping less effective,
+    //  draw compares the actual state.
+    auto textures = std::hash<void*>()(mrc.getTexture()) ^ (std::hash<void*>()(mrc.getSpecularTexture()) * 31) ^ (std::hash<void*>()(mrc.getIlluminationTexture()) * 961);
+    auto mesh = std::hash<void*>()(mrc.getMesh());
+    return (uint64_t(lookUpShaderId(mrc)) << 56) | ((uint64_t(textures) & 0xFFFFFFF) << 28) | (uint64_t(mesh) & 0xFFFFFFF);
+}
 
-    // Textures
-    activateAndBindMeshTextures(mrc);
+void MeshRenderSystem::draw(MeshRenderComponent& mrc, Mesh* mesh, const glm::mat4& model_matrix, const glm::mat4& light_matrix)
+{
+    auto shader_id = lookUpShaderId(mrc);
+    if (!active_shader || shader_id != active_shader_id)
+    {
+        flush3D();
+        active_shader.emplace(shader_id);
+        active_shader_id = shader_id;
+        active_attributes.emplace_back(active_shader->get().attribute(ShaderRegistry::Attributes::Position));
+        active_attributes.emplace_back(active_shader->get().attribute(ShaderRegistry::Attributes::Texcoords));
+        active_attributes.emplace_back(active_shader->get().attribute(ShaderRegistry::Attributes::Normal));
+    }
+    auto& shader = active_shader->get();
 
-    // Draw
-    drawMesh(mrc, shader);
+    std::array<sp::Texture*, 3> textures{mrc.getTexture(), mrc.getSpecularTexture(), mrc.getIlluminationTexture()};
+    if (textures[0] && textures[0] != active_textures[0])
+        textures[0]->bind();
+    if (textures[1] && textures[1] != active_textures[1])
+    {
+        glActiveTexture(GL_TEXTURE0 + ShaderRegistry::textureIndex(ShaderRegistry::Textures::SpecularMap));
+        textures[1]->bind();
+        glActiveTexture(GL_TEXTURE0);
+    }
+    if (textures[2] && textures[2] != active_textures[2])
+    {
+        glActiveTexture(GL_TEXTURE0 + ShaderRegistry::textureIndex(ShaderRegistry::Textures::IlluminationMap));
+        textures[2]->bind();
+        glActiveTexture(GL_TEXTURE0);
+    }
+    // Texture units of textures that are not used keep the previous texture bound, like before.
+    for(size_t n=0; n<textures.size(); n++)
+        if (textures[n])
+            active_textures[n] = textures[n];
+
+    if (mesh != active_mesh)
+    {
+        if (!mesh->bind(active_attributes[0].get(), active_attributes[1].get(), active_attributes[2].get()))
+            return;
+        active_mesh = mesh;
+    }
+
+    glUniformMatrix4fv(shader.uniform(ShaderRegistry::Uniforms::Model), 1, GL_FALSE, glm::value_ptr(model_matrix));
+    ShaderRegistry::setupLights(shader, light_matrix);
+    mesh->draw();
+}
 
+void MeshRenderSystem::flush3D()
+{
+    if (active_mesh)
+        Mesh::unbind();
+    active_mesh = nullptr;
+    active_attributes.clear();
+    active_shader.reset();
+    active_textures = {};
 }
 
 void NebulaRenderSystem::update(float delta)
@@ -135,51 +243,87 @@ void NebulaRenderSystem::update(float delta)
 
 void NebulaRenderSystem::render3D(sp::ecs::Entity e, sp::Transform& transform, NebulaRenderer& nr)
 {
-    ShaderRegistry::ScopedShader shader(ShaderRegistry::Shaders::Billboard);
-
-    struct VertexAndTexCoords
-    {
-        glm::vec3 vertex;
-        glm::vec2 texcoords;
-    };
-    std::array<VertexAndTexCoords, 4> quad{
-        glm::vec3{}, {0.f, 1.f},
-        glm::vec3{}, {1.f, 1.f},
-        glm::vec3{}, {1.f, 0.f},
-        glm::vec3{}, {0.f, 0.f}
-    };
-
-    gl::ScopedVertexAttribArray positions(shader.get().attribute(ShaderRegistry::Attributes::Position));
-    gl::ScopedVertexAttribArray texcoords(shader.get().attribute(ShaderRegistry::Attributes::Texcoords));
-
+    auto view = ShaderRegistry::getActiveView();
     for(auto& cloud : nr.clouds)
     {
-        glm::vec3 position = glm::vec3(transform.getPosition().x, transform.getPosition().y, 0) + glm::vec3(cloud.offset.x, cloud.offset.y, 0);
+        glm::vec3 offset = glm::vec3(cloud.offset.x, cloud.offset.y, 0);
+        glm::vec3 position = glm::vec3(transform.getPosition().x, transform.getPosition().y, 0) + offset;
         float size = cloud.size;
 
         float distance = glm::length(camera_position - position);
+        // The clouds were always drawn with the offset applied twice, while the fade uses it once.
+        position += offset;
         float alpha = 1.0f - (distance / nr.render_range);
-        if (alpha < 0.0f)
+        // Skip clouds that are too far away to add anything, or completely behind the camera.
+        if (alpha * 0.8f < 1.0f / 255.0f)
             continue;
+        if ((view * glm::vec4(position, 1.0f)).z > size * 0.5f)
+            continue;
+
+        if (!cloud.texture.ptr)
+            cloud.texture.ptr = textureManager.getTexture(cloud.texture.name);
+        auto batch = std::find_if(batches.begin(), batches.end(), [&cloud](const Batch& b) { return b.texture == cloud.texture.ptr; });
+        if (batch == batches.end())
+            batch = batches.insert(batches.end(), Batch{cloud.texture.ptr, {}});
+
+        glm::vec4 color{alpha * 0.8f, alpha * 0.8f, alpha * 0.8f, size};
+        batch->vertices.push_back({position, {0.f, 1.f}, color});
+        batch->vertices.push_back({position, {1.f, 1.f}, color});
+        batch->vertices.push_back({position, {1.f, 0.f}, color});
+        batch->vertices.push_back({position, {0.f, 0.f}, color});
+    }
+}
+
+void NebulaRenderSystem::flush3D()
+{
+    if (std::all_of(batches.begin(), batches.end(), [](const Batch& b) { return b.vertices.empty(); }))
+        return;
 
-        // setup our quad.
-        for (auto& point : quad)
+    if (!buffers[0])
+    {
+        buffers = gl::Buffers<2>{};
+        std::vector<uint16_t> elements(clouds_per_draw * elements_per_cloud);
+        for(size_t n=0; n<clouds_per_draw; n++)
         {
-            point.vertex = position;
+            auto base_vertex = static_cast<uint16_t>(n * vertices_per_cloud);
+            elements[n * elements_per_cloud + 0] = base_vertex + 0;
+            elements[n * elements_per_cloud + 1] = base_vertex + 3;
+            elements[n * elements_per_cloud + 2] = base_vertex + 2;
+            elements[n * elements_per_cloud + 3] = base_vertex + 0;
+            elements[n * elements_per_cloud + 4] = base_vertex + 2;
+            elements[n * elements_per_cloud + 5] = base_vertex + 1;
         }
+        gl::ScopedBufferBinding element_buffer(GL_ELEMENT_ARRAY_BUFFER, buffers[0]);
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, elements.size() * sizeof(uint16_t), elements.data(), GL_STATIC_DRAW);
+    }
 
-        if (!cloud.texture.ptr)
-            cloud.texture.ptr = textureManager.getTexture(cloud.texture.name);
-        if (cloud.texture.ptr)
-            cloud.texture.ptr->bind();
-        glUniform4f(shader.get().uniform(ShaderRegistry::Uniforms::Color), alpha * 0.8f, alpha * 0.8f, alpha * 0.8f, size);
-        auto cloud_model_matrix = glm::translate(glm::identity<glm::mat4>(), {cloud.offset.x, cloud.offset.y, 0});
-        glUniformMatrix4fv(shader.get().uniform(ShaderRegistry::Uniforms::Model), 1, GL_FALSE, glm::value_ptr(cloud_model_matrix));
-
-        glVertexAttribPointer(positions.get(), 3, GL_FLOAT, GL_FALSE, sizeof(VertexAndTexCoords), (GLvoid*)quad.data());
-        glVertexAttribPointer(texcoords.get(), 2, GL_FLOAT, GL_FALSE, sizeof(VertexAndTexCoords), (GLvoid*)((char*)quad.data() + sizeof(glm::vec3)));
-        std::initializer_list<uint16_t> indices = { 0, 3, 2, 0, 2, 1 };
-        glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_SHORT, std::begin(indices));
+    ShaderRegistry::ScopedShader shader(ShaderRegistry::Shaders::BillboardBatch);
+
+    gl::ScopedVertexAttribArray positions(shader.get().attribute(ShaderRegistry::Attributes::Position));
+    gl::ScopedVertexAttribArray texcoords(shader.get().attribute(ShaderRegistry::Attributes::Texcoords));
+    gl::ScopedVertexAttribArray colors(shader.get().attribute(ShaderRegistry::Attributes::Color));
+    gl::ScopedBufferBinding element_buffer(GL_ELEMENT_ARRAY_BUFFER, buffers[0]);
+    gl::ScopedBufferBinding vertex_buffer(GL_ARRAY_BUFFER, buffers[1]);
+
+    for(auto& batch : batches)
+    {
+        if (batch.vertices.empty())
+            continue;
+        if (batch.texture)
+            batch.texture->bind();
+
+        // Replace the whole buffer, so the driver does not need to wait for the previous draw to finish.
+        glBufferData(GL_ARRAY_BUFFER, batch.vertices.size() * sizeof(Vertex), batch.vertices.data(), GL_STREAM_DRAW);
+        auto cloud_count = batch.vertices.size() / vertices_per_cloud;
+        for(size_t n=0; n<cloud_count; n+=clouds_per_draw)
+        {
+            auto first_vertex = n * vertices_per_cloud * sizeof(Vertex);
+            glVertexAttribPointer(positions.get(), 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), reinterpret_cast<const GLvoid*>(first_vertex + offsetof(Vertex, position)));
+            glVertexAttribPointer(texcoords.get(), 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), reinterpret_cast<const GLvoid*>(first_vertex + offsetof(Vertex, texcoords)));
+            glVertexAttribPointer(colors.get(), 4, GL_FLOAT, GL_FALSE, sizeof(Vertex), reinterpret_cast<const GLvoid*>(first_vertex + offsetof(Vertex, color)));
+            glDrawElements(GL_TRIANGLES, static_cast<GLsizei>(std::min(cloud_count - n, clouds_per_draw) * elements_per_cloud), GL_UNSIGNED_SHORT, nullptr);
+        }
+        batch.vertices.clear();
     }
 }
 
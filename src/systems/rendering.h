@@ -6,19 +6,32 @@
 #include "components/collision.h"
 #include "components/rendering.h"
 #include "main.h"
+#include "glObjects.h"
+#include "profiler.h"
 #include <glm/geometric.hpp>
+#include <limits>
+#include <optional>
+#include <array>
 
 template<typename COMPONENT, bool TRANSPARENT> class Render3DInterface {
 public:
     Render3DInterface();
     virtual void render3D(sp::ecs::Entity e, sp::Transform& transform, COMPONENT& component) = 0;
+    // Opaque objects are drawn grouped per handler and ordered on this key, so objects that need the same GL state are drawn after each other.
+    virtual uint64_t sortKey(sp::ecs::Entity e, COMPONENT& component) { return 0; }
+    // Called after the last opaque object of the handler in a depth range, and after all transparent objects of a depth range.
+    //  Handlers can keep GL state bound between render3D calls, or collect objects in render3D and draw them here in one go.
+    //  Transparent objects are drawn with additive blending, so drawing them out of order does not change the result.
+    virtual void flush3D() {}
 };
 
 class RenderSystem
 {
 public:
     template<typename COMPONENT, bool TRANSPARENT> static void add3DHandler(Render3DInterface<COMPONENT, TRANSPARENT>* rif) {
-        render_handlers.push_back({rif, &RenderSystem::findRenderObjects<COMPONENT, TRANSPARENT>});
+        render_handlers.push_back({rif, &RenderSystem::findRenderObjects<COMPONENT, TRANSPARENT>, [](void* rif_ptr) {
+            reinterpret_cast<Render3DInterface<COMPONENT, TRANSPARENT>*>(rif_ptr)->flush3D();
+        }});
     }
 
     void render3D(float aspect, float camera_fov);
@@ -30,6 +43,7 @@ private:
         sp::ecs::Entity entity;
         float depth;
         bool transparent;
+        uint64_t sort_key;
         void* rif;
         sp::Transform* transform;
         void* component_ptr;
@@ -37,6 +51,8 @@ private:
     };
     std::vector<std::vector<RenderEntry>> render_lists;
 
+    void flushHandler(void* rif);
+
     template<typename COMPONENT, bool TRANSPARENT> void findRenderObjects(void* rif_ptr) {
         for(auto [entity, t, transform] : sp::ecs::Query<COMPONENT, sp::Transform>())
         {
@@ -53,7 +69,10 @@ private:
             int render_list_index = std::max(0, int((depth + radius) / 25000));
             while(render_list_index >= int(render_lists.size()))
                 render_lists.emplace_back();
-            render_lists[render_list_index].push_back({entity, depth, TRANSPARENT, rif_ptr, &transform, &t, [](void* rif_ptr, sp::ecs::Entity e, sp::Transform& transform, void* comp_ptr) {
+            uint64_t sort_key = TRANSPARENT ? 0 : reinterpret_cast<Render3DInterface<COMPONENT, TRANSPARENT>*>(rif_ptr)->sortKey(entity, t);
+            render_lists[render_list_index].push_back({entity, depth, TRANSPARENT, sort_key, rif_ptr, &transform, &t, [](void* rif_ptr, sp::ecs::Entity e, sp::Transform& transform, void* comp_ptr) {
+                static const char* profile_name = Profiler::intern("3D " + Profiler::typeName(typeid(COMPONENT)));
+                Profiler::Scope scope(profile_name);
                 auto rif = reinterpret_cast<Render3DInterface<COMPONENT, TRANSPARENT>*>(rif_ptr);
                 auto comp = reinterpret_cast<COMPONENT*>(comp_ptr);
                 rif->render3D(e, transform, *comp);
@@ -64,6 +83,7 @@ private:
     struct RenderHandler {
         void* rif;
         void (RenderSystem::* func)(void* rif);
+        void (*flush)(void* rif);
     };
     static std::vector<RenderHandler> render_handlers;
 };
@@ -72,22 +92,55 @@ template<typename COMPONENT, bool TRANSPARENT> Render3DInterface<COMPONENT, TRAN
 
 // FIX: This is obviously not the right place to define these utility functions
 glm::mat4 calculateModelMatrix(glm::vec2 position, float rotation, glm::vec3 mesh_offset, float scale);
+ShaderRegistry::Shaders lookUpShaderId(MeshRenderComponent& mrc);
 ShaderRegistry::ScopedShader lookUpShader(MeshRenderComponent& mrc);
 void activateAndBindMeshTextures(MeshRenderComponent& mrc);
 void drawMesh(MeshRenderComponent& mrc, ShaderRegistry::ScopedShader& shader);
 
+// Meshes are sorted on shader, textures and mesh. The shader, textures and mesh buffers stay bound between render3D calls
+//  and are only changed when the next object needs something else, until flush3D.
 class MeshRenderSystem : public sp::ecs::System, public Render3DInterface<MeshRenderComponent, false>
 {
 public:
     void update(float delta) override;
     void render3D(sp::ecs::Entity e, sp::Transform& transform, MeshRenderComponent& mrc) override;
+    uint64_t sortKey(sp::ecs::Entity e, MeshRenderComponent& mrc) override;
+    void flush3D() override;
+private:
+    void draw(MeshRenderComponent& mrc, Mesh* mesh, const glm::mat4& model_matrix, const glm::mat4& light_matrix);
+
+    std::optional<ShaderRegistry::ScopedShader> active_shader;
+    ShaderRegistry::Shaders active_shader_id = ShaderRegistry::Shaders::Count;
+    std::vector<gl::ScopedVertexAttribArray> active_attributes;
+    std::array<sp::Texture*, 3> active_textures{};
+    Mesh* active_mesh = nullptr;
 };
 
+// Clouds are not drawn one by one, but collected per texture and drawn with a single draw call per texture in flush3D.
 class NebulaRenderSystem : public sp::ecs::System, public Render3DInterface<NebulaRenderer, true>
 {
 public:
     void update(float delta) override;
     void render3D(sp::ecs::Entity e, sp::Transform& transform, NebulaRenderer& nr) override;
+    void flush3D() override;
+private:
+    static constexpr size_t vertices_per_cloud = 4;
+    static constexpr size_t elements_per_cloud = 6;
+    static constexpr size_t clouds_per_draw = (std::numeric_limits<uint16_t>::max() + 1) / vertices_per_cloud;
+
+    struct Vertex
+    {
+        glm::vec3 position;
+        glm::vec2 texcoords;
+        glm::vec4 color; // Size of the cloud in alpha.
+    };
+    struct Batch
+    {
+        sp::Texture* texture;
+        std::vector<Vertex> vertices;
+    };
+    std::vector<Batch> batches;
+    gl::Buffers<2> buffers{ gl::Unitialized{} };
 };
 
 class ExplosionRenderSystem : public sp::ecs::System, public Render3DInterface<ExplosionEffect, true>
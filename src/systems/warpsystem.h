@@ -7,7 +7,7 @@
 #include <glm/vec2.hpp>
 
 
-class WarpSystem : public sp::ecs::System, public RenderRadarInterface<WarpJammer, 20, RadarRenderSystem::FlagLongRange>
+class WarpSystem : public sp::ecs::System, public RenderRadarInterface<WarpJammer, 20, RadarRenderSystem::FlagLongRange, false>
 {
 public:
     void update(float delta) override;